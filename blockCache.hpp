@@ -0,0 +1,116 @@
+// A bounded LRU cache of fixed-size blocks (clusters), split into shards with their own locks so that many threads can use it at once.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+class BlockCache {
+public:
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+  };
+
+  // Holds at most `memoryBudget` bytes of blocks of `blockSize` bytes each (at least one block per shard).
+  BlockCache(size_t blockSize_, size_t memoryBudget, size_t numShards = 16): blockSize(blockSize_), shards(numShards) {
+    size_t blocksPerShard = std::max((size_t)1, memoryBudget / blockSize / numShards);
+    for (Shard& shard : shards) {
+      shard.capacity = blocksPerShard;
+      shard.slab.reset(new uint8_t[blocksPerShard * blockSize]);
+    }
+  }
+
+  BlockCache(const BlockCache& other) = delete;
+
+  // Copies `length` bytes starting `offsetInBlock` bytes into block `key` to `out` and marks the block as most recently used. Returns false if it isn't cached.
+  bool lookup(uint64_t key, void* out, size_t offsetInBlock, size_t length) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      misses++;
+      return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    memcpy(out, shard.slot(it->second->slot, blockSize) + offsetInBlock, length);
+    hits++;
+    return true;
+  }
+
+  // Caches a copy of the `blockSize` bytes at `data` as block `key`, evicting the least recently used block of its shard if needed.
+  void insert(uint64_t key, const void* data) {
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      memcpy(shard.slot(it->second->slot, blockSize), data, blockSize);
+      return;
+    }
+    size_t slot;
+    if (shard.lru.size() < shard.capacity) {
+      slot = shard.lru.size();
+    }
+    else {
+      // Evict
+      Entry& victim = shard.lru.back();
+      slot = victim.slot;
+      shard.index.erase(victim.key);
+      shard.lru.pop_back();
+      evictions++;
+    }
+    shard.lru.push_front({key, slot});
+    shard.index[key] = shard.lru.begin();
+    memcpy(shard.slot(slot, blockSize), data, blockSize);
+  }
+
+  void clear() {
+    for (Shard& shard : shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.lru.clear();
+      shard.index.clear();
+    }
+  }
+
+  Stats stats() const {
+    return {hits.load(), misses.load(), evictions.load()};
+  }
+
+  // Total bytes that can be cached.
+  size_t capacityInBytes() const {
+    return shards.size() * shards[0].capacity * blockSize;
+  }
+
+  const size_t blockSize;
+
+protected:
+  struct Entry {
+    uint64_t key;
+    size_t slot; // Index of the block's storage in `Shard::slab`
+  };
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> lru; // Most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    std::unique_ptr<uint8_t[]> slab; // Storage for `capacity` blocks, allocated once
+    size_t capacity;
+
+    uint8_t* slot(size_t i, size_t blockSize) { return slab.get() + i * blockSize; }
+  };
+  std::vector<Shard> shards;
+  std::atomic<uint64_t> hits{0}, misses{0}, evictions{0};
+
+  Shard& shardFor(uint64_t key) {
+    // Neighbouring blocks go to different shards
+    return shards[key % shards.size()];
+  }
+};
@@ -0,0 +1,193 @@
+// Support for reading from fds opened with O_DIRECT, which bypasses the page cache but requires every read's buffer address, file offset and length to be aligned (usually to the sector size).
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cassert>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "readEngine.hpp"
+
+// The alignment that O_DIRECT reads from `fd` need, or 0 if it can't be told. For a block device that is its logical block size. For a regular file (e.g. an image) it is up to the file system it is on, whose block size can be larger than the sectors of the NTFS volume inside: what it reports with statx(STATX_DIOALIGN) (Linux 6.1 and later), or else its block size, which is always enough.
+inline size_t directIOAlignmentOf(int fd) {
+  int blockSize;
+  if (ioctl(fd, BLKSSZGET, &blockSize) == 0) {
+    return blockSize;
+  }
+#ifdef STATX_DIOALIGN
+  struct statx stx;
+  if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align != 0) {
+    return std::max(stx.stx_dio_offset_align, stx.stx_dio_mem_align);
+  }
+#endif
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_blksize > 0 && (st.st_blksize & (st.st_blksize - 1)) == 0) {
+    return st.st_blksize;
+  }
+  return 0;
+}
+
+// A pool of `bufferSize`-byte buffers aligned to `alignment` bytes, recycled so that O_DIRECT reads don't need to allocate each time.
+class AlignedBufferPool {
+public:
+  AlignedBufferPool(size_t alignment_, size_t bufferSize_, size_t maxFreeBuffers_ = 64): alignment(alignment_), bufferSize(bufferSize_), maxFreeBuffers(maxFreeBuffers_) {
+    assert(bufferSize % alignment == 0);
+  }
+
+  AlignedBufferPool(const AlignedBufferPool& other) = delete;
+
+  ~AlignedBufferPool() {
+    for (void* buf : freeBuffers) {
+      free(buf);
+    }
+  }
+
+  // Returns a buffer of `bufferSize` bytes. Give it back with `release()`.
+  void* acquire() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!freeBuffers.empty()) {
+	void* ret = freeBuffers.back();
+	freeBuffers.pop_back();
+	return ret;
+      }
+    }
+    void* ret;
+    int err = posix_memalign(&ret, alignment, bufferSize);
+    if (err != 0) {
+      errno = err;
+      perror("posix_memalign failed");
+      throw err;
+    }
+    return ret;
+  }
+
+  void release(void* buf) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (freeBuffers.size() < maxFreeBuffers) {
+	freeBuffers.push_back(buf);
+	return;
+      }
+    }
+    free(buf);
+  }
+
+  const size_t alignment;
+  const size_t bufferSize;
+
+protected:
+  const size_t maxFreeBuffers;
+  std::vector<void*> freeBuffers;
+  std::mutex mutex;
+};
+
+// Reads `requests` from an fd opened with O_DIRECT using `engine`. Requests that are already aligned to `pool.alignment` are read straight into their buffers; the rest are widened to aligned boundaries, read into buffers from `pool` in `pool.bufferSize` chunks, and the wanted bytes copied out. If `fileSize` is given, a chunk that the widening takes past the end of the file is read up to the end and the rest zeroed, since O_DIRECT returns less than asked for there.
+inline void readAllDirect(ReadEngine& engine, AlignedBufferPool& pool, int fd, const std::vector<ReadRequest>& requests, off_t fileSize = 0) {
+  const size_t alignment = pool.alignment;
+  auto isAligned = [&](uintmax_t x) { return x % alignment == 0; };
+
+  // Part of a request's destination: where `length` bytes from `offset` in the file go
+  struct Piece {
+    void* dest;
+    off_t offset;
+    size_t length;
+  };
+  struct CopyOut {
+    void* dest;
+    const uint8_t* src;
+    size_t length;
+  };
+  // A bounce chunk that runs past the end of the file, where O_DIRECT returns fewer bytes than asked for. `needed` is how many of them the requests cover.
+  struct Tail {
+    ReadRequest read;
+    size_t needed;
+  };
+  std::vector<ReadRequest> direct;
+  std::vector<Tail> tails;
+  std::vector<CopyOut> copyOuts;
+  std::vector<void*> bounceBuffers;
+  direct.reserve(requests.size());
+  try {
+    std::vector<Piece> pieces;
+    for (const ReadRequest& r : requests) {
+      pieces.clear();
+      bool aligned = isAligned(r.offset) && isAligned(r.length);
+      if (r.iov != nullptr) {
+	off_t offset = r.offset;
+	for (int i = 0; i < r.iovcnt; i++) {
+	  pieces.push_back({r.iov[i].iov_base, offset, r.iov[i].iov_len});
+	  aligned = aligned && isAligned((uintptr_t)r.iov[i].iov_base) && isAligned(r.iov[i].iov_len);
+	  offset += r.iov[i].iov_len;
+	}
+      }
+      else {
+	pieces.push_back({r.buf, r.offset, r.length});
+	aligned = aligned && isAligned((uintptr_t)r.buf);
+      }
+      if (aligned) {
+	direct.push_back(r);
+	continue;
+      }
+
+      // Read [alignedStart, alignedEnd) in chunks and copy out the overlap with each piece
+      off_t alignedStart = r.offset / alignment * alignment;
+      off_t alignedEnd = (r.offset + r.length + alignment - 1) / alignment * alignment;
+      size_t piece = 0;
+      for (off_t chunkStart = alignedStart; chunkStart < alignedEnd; chunkStart += pool.bufferSize) {
+	size_t chunkLength = std::min((off_t)pool.bufferSize, alignedEnd - chunkStart);
+	off_t chunkEnd = chunkStart + chunkLength;
+	void* bounce = pool.acquire();
+	bounceBuffers.push_back(bounce);
+	if (fileSize > 0 && chunkEnd > fileSize) {
+	  tails.push_back({{bounce, chunkLength, chunkStart}, (size_t)(std::min(chunkEnd, r.offset + (off_t)r.length) - chunkStart)});
+	}
+	else {
+	  direct.push_back({bounce, chunkLength, chunkStart});
+	}
+
+	for (; piece < pieces.size() && pieces[piece].offset < chunkEnd; piece++) {
+	  const Piece& p = pieces[piece];
+	  off_t from = std::max(chunkStart, p.offset), to = std::min(chunkEnd, p.offset + (off_t)p.length);
+	  if (from < to) {
+	    copyOuts.push_back({(uint8_t*)p.dest + (from - p.offset), (const uint8_t*)bounce + (from - chunkStart), (size_t)(to - from)});
+	  }
+	  if (p.offset + (off_t)p.length > chunkEnd) {
+	    break; // The rest of this piece is in the next chunk
+	  }
+	}
+      }
+    }
+
+    engine.readAll(fd, direct);
+    for (const Tail& t : tails) {
+      size_t got = preadUntilEOF(fd, t.read.buf, t.read.length, t.read.offset);
+      if (got < t.needed) {
+	fprintf(stderr, "readAllDirect: got too few bytes: expected %zu but got %zu at file offset %jd\n", t.needed, got, (intmax_t)t.read.offset);
+	throw EIO;
+      }
+      memset((uint8_t*)t.read.buf + got, 0, t.read.length - got);
+    }
+    for (const CopyOut& c : copyOuts) {
+      memcpy(c.dest, c.src, c.length);
+    }
+  }
+  catch (...) {
+    for (void* bounce : bounceBuffers) {
+      pool.release(bounce);
+    }
+    throw;
+  }
+  for (void* bounce : bounceBuffers) {
+    pool.release(bounce);
+  }
+}
@@ -0,0 +1,182 @@
+// Counters for every read from disk (bytes, syscalls, seek distance and latency), attributed to the phase of the scan that made them, to tell whether a slow run is seek-bound or bandwidth-bound.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+
+enum IOPhase {
+  IO_PHASE_OTHER,
+  IO_PHASE_PARTITION_TABLE,
+  IO_PHASE_BOOT_SECTOR,
+  IO_PHASE_MFT_LOAD,
+  IO_PHASE_ATTRIBUTE_CONTENT,
+  IO_PHASE_RECORD_NAVIGATION,
+  IO_PHASE_MFT_SCAN,
+  IO_PHASE_COUNT
+};
+
+inline const char* ioPhaseName(IOPhase phase) {
+  switch (phase) {
+  case IO_PHASE_OTHER: return "other";
+  case IO_PHASE_PARTITION_TABLE: return "partition table";
+  case IO_PHASE_BOOT_SECTOR: return "boot sector";
+  case IO_PHASE_MFT_LOAD: return "MFT load";
+  case IO_PHASE_ATTRIBUTE_CONTENT: return "attribute content";
+  case IO_PHASE_RECORD_NAVIGATION: return "record navigation";
+  case IO_PHASE_MFT_SCAN: return "MFT scan";
+  default: return "?";
+  }
+}
+
+// The phase that reads made by this thread are counted under. Set it with `IOPhaseScope`.
+inline IOPhase& currentIOPhase() {
+  thread_local IOPhase phase = IO_PHASE_OTHER;
+  return phase;
+}
+
+// Counts the reads made by this thread under `phase` until it goes out of scope, unless an enclosing scope already set a phase: the outermost scope wins, so a caller can claim the reads of the functions it calls (e.g. loading the MFT's $DATA is an MFT load even though it goes through the attribute content code).
+class IOPhaseScope {
+public:
+  explicit IOPhaseScope(IOPhase phase): previous(currentIOPhase()) {
+    if (previous == IO_PHASE_OTHER) {
+      currentIOPhase() = phase;
+    }
+  }
+
+  IOPhaseScope(const IOPhaseScope& other) = delete;
+
+  ~IOPhaseScope() {
+    currentIOPhase() = previous;
+  }
+
+protected:
+  IOPhase previous;
+};
+
+class IOStats {
+public:
+  static const size_t LATENCY_BUCKETS = 40; // Bucket i holds latencies in [2^i, 2^(i+1)) nanoseconds (bucket 0 also holds 0)
+
+  // A copy of the counters of one phase
+  struct Phase {
+    uint64_t reads; // Syscalls, or io_uring submissions, that read from the disk
+    uint64_t bytes;
+    uint64_t seekDistance; // Sum of the distances in bytes between where each read started and where the previous one ended
+    uint64_t nanoseconds; // Total wall time spent in reads (overlapping reads are counted separately)
+    uint64_t mappedBytes; // Bytes viewed in place in a memory-mapped file. These don't go through a read, so the page faults they cause aren't counted above.
+    uint64_t latencyHistogram[LATENCY_BUCKETS];
+
+    // Approximate latency in nanoseconds at `percentile` (0 to 100): the top of the bucket it falls in.
+    uint64_t latencyPercentile(double percentile) const {
+      uint64_t target = (uint64_t)(reads * percentile / 100), seen = 0;
+      for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+	seen += latencyHistogram[i];
+	if (seen > target || (seen == reads && seen > 0)) {
+	  return ((uint64_t)1 << (i + 1)) - 1;
+	}
+      }
+      return 0;
+    }
+  };
+
+  // Counting is off until this is set, so that the clock isn't read for every read when nobody wants the numbers.
+  std::atomic<bool> enabled{false};
+
+  // Returns the time to pass to `recordRead` once the read is done, or 0 if counting is disabled.
+  uint64_t start() const {
+    return enabled.load(std::memory_order_relaxed) ? now() : 0;
+  }
+
+  // Counts a read of `bytes` bytes at file offset `offset` of `fd` that began at `startTime` (from `start`) under `phase`.
+  void recordRead(IOPhase phase, uint64_t startTime, int fd, off_t offset, size_t bytes) {
+    if (startTime == 0) {
+      return;
+    }
+    uint64_t nanoseconds = now() - startTime;
+    Counters& c = counters[phase];
+    c.reads.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    c.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    c.latencyHistogram[bucketFor(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    off_t previousEnd = lastEndOf(fd).exchange(offset + bytes, std::memory_order_relaxed);
+    c.seekDistance.fetch_add(offset > previousEnd ? offset - previousEnd : previousEnd - offset, std::memory_order_relaxed);
+  }
+
+  // Forgets where the last read from `fd` ended, for when it is closed, so that a file that later gets the same fd doesn't measure its first seek from there.
+  void forgetFd(int fd) {
+    lastEndOf(fd).store(0, std::memory_order_relaxed);
+  }
+
+  // Counts `bytes` bytes viewed in a memory-mapped file under the current phase.
+  void recordMapped(size_t bytes) {
+    if (enabled.load(std::memory_order_relaxed)) {
+      counters[currentIOPhase()].mappedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+  }
+
+  Phase snapshot(IOPhase phase) const {
+    const Counters& c = counters[phase];
+    Phase ret = {c.reads.load(), c.bytes.load(), c.seekDistance.load(), c.nanoseconds.load(), c.mappedBytes.load(), {}};
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+      ret.latencyHistogram[i] = c.latencyHistogram[i].load();
+    }
+    return ret;
+  }
+
+  // Prints a table of the phases that did anything, then each one's latency histogram.
+  void report(FILE* f) const {
+    fprintf(f, "I/O stats:\n%-18s %10s %14s %16s %12s %10s %10s %14s\n", "phase", "reads", "bytes", "seek distance", "time (ms)", "p50 (us)", "p99 (us)", "mapped bytes");
+    for (int p = 0; p < IO_PHASE_COUNT; p++) {
+      Phase s = snapshot((IOPhase)p);
+      if (s.reads == 0 && s.mappedBytes == 0) {
+	continue;
+      }
+      fprintf(f, "%-18s %10ju %14ju %16ju %12.3f %10.1f %10.1f %14ju\n", ioPhaseName((IOPhase)p), (uintmax_t)s.reads, (uintmax_t)s.bytes, (uintmax_t)s.seekDistance, s.nanoseconds / 1e6, s.latencyPercentile(50) / 1e3, s.latencyPercentile(99) / 1e3, (uintmax_t)s.mappedBytes);
+    }
+    for (int p = 0; p < IO_PHASE_COUNT; p++) {
+      Phase s = snapshot((IOPhase)p);
+      if (s.reads == 0) {
+	continue;
+      }
+      fprintf(f, "Latency histogram for %s:\n", ioPhaseName((IOPhase)p));
+      for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+	if (s.latencyHistogram[i] > 0) {
+	  fprintf(f, "  [%10.1f us, %10.1f us): %ju\n", i == 0 ? 0 : ((uint64_t)1 << i) / 1e3, ((uint64_t)1 << (i + 1)) / 1e3, (uintmax_t)s.latencyHistogram[i]);
+	}
+      }
+    }
+  }
+
+protected:
+  struct Counters {
+    std::atomic<uint64_t> reads{0}, bytes{0}, seekDistance{0}, nanoseconds{0}, mappedBytes{0};
+    std::atomic<uint64_t> latencyHistogram[LATENCY_BUCKETS] = {};
+  };
+  Counters counters[IO_PHASE_COUNT];
+  static const size_t TRACKED_FDS = 1024;
+  std::atomic<off_t> lastEnd[TRACKED_FDS] = {}; // Where the last read from each fd ended, shared by all threads reading it. Per fd, since seeks between different volumes (or disks) being scanned at once say nothing about any of them. (Fds past the end share entries, which only blurs their seek distances.)
+
+  std::atomic<off_t>& lastEndOf(int fd) {
+    return lastEnd[(unsigned)fd % TRACKED_FDS];
+  }
+
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static size_t bucketFor(uint64_t nanoseconds) {
+    size_t bucket = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    return std::min(bucket, LATENCY_BUCKETS - 1);
+  }
+};
+
+// The counters for the whole process
+inline IOStats& ioStats() {
+  static IOStats stats;
+  return stats;
+}
@@ -0,0 +1,52 @@
+// Leveled logging for the diagnostic output of the hot paths (fixups, attribute walks, run decoding, loads). Levels above `NTFS_LOG_MAX_LEVEL` are compiled out entirely, arguments and all, so release builds pay nothing for them; the rest are filtered at runtime by `logLevel()`.
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+
+enum LogLevel {
+  LOG_ERROR,
+  LOG_WARN,
+  LOG_INFO,
+  LOG_DEBUG,
+  LOG_TRACE // Per sector, per run or per attribute: enough to drown a whole-MFT scan in terminal I/O
+};
+
+// The most verbose level compiled in. Release builds (`make RELEASE=1`, which defines NDEBUG) keep up to LOG_INFO; debug builds keep everything. Define it on the command line (e.g. -DNTFS_LOG_MAX_LEVEL=LOG_WARN) to override.
+#ifndef NTFS_LOG_MAX_LEVEL
+#ifdef NDEBUG
+#define NTFS_LOG_MAX_LEVEL LOG_INFO
+#else
+#define NTFS_LOG_MAX_LEVEL LOG_TRACE
+#endif
+#endif
+
+// The most verbose level printed at runtime (see `--log-level`). Set it before starting any threads.
+inline LogLevel& logLevel() {
+  static LogLevel level = LOG_INFO;
+  return level;
+}
+
+// Parses "error", "warn", "info", "debug" or "trace" into `out`. Returns false if `name` is none of them.
+inline bool parseLogLevel(const char* name, LogLevel* out) {
+  static const char* const names[] = {"error", "warn", "info", "debug", "trace"};
+  for (int i = 0; i <= LOG_TRACE; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *out = (LogLevel)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Whether messages at `level` are printed. Constant false for levels that are compiled out, so code guarded by it (e.g. hex dumps) is removed too.
+#define LOG_ENABLED(level) ((level) <= NTFS_LOG_MAX_LEVEL && (level) <= logLevel())
+
+// printf()s the rest of the arguments to stdout if `level` is enabled.
+#define LOG(level, ...)				\
+  do {						\
+    if (LOG_ENABLED(level)) {			\
+      printf(__VA_ARGS__);			\
+    }						\
+  } while (0)
@@ -1,6 +1,11 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <limits.h>
 #include <stdio.h>
 #include <errno.h>
 #include "ap/ap.hpp" // https://github.com/arbitrary-precision/ap
@@ -10,11 +15,19 @@
 #include "stdvisit_helpers.hpp"
 #include "utils.hpp"
 #include "tools.h"
+#include "readEngine.hpp"
+#include "log.hpp"
+#include "directIO.hpp"
+#include "blockCache.hpp"
+#include "partitionTable.hpp"
+#include "threadPool.hpp"
 #include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
 // https://www.cplusplus.com/reference/locale/wstring_convert/
 #include <locale>         // std::wstring_convert
 #include <codecvt>        // std::codecvt_utf8
-#include <gmpxx.h> // C++ API for The GNU Multiple Precision Arithmetic Library (GMP)
 #include <type_traits>
 
 // Required due to a deficiency in C++ std::pair constructors: https://stackoverflow.com/questions/64527951/why-is-stdpair-from-anonymous-object-copying-that-object-instead-of-moving
@@ -27,6 +40,9 @@ struct Pair {
 // Attempt to ensure little-endian CPU (big-endian CPU could be supported but would require using conversions when reading/writing to structs that represent on-disk data structures from NTFS, such as using https://man7.org/linux/man-pages/man3/endian.3.html )
 // Based on https://stackoverflow.com/questions/4239993/determining-endianness-at-compile-time :
 #include <endian.h> // Or try <sys/param.h>
+#ifdef __SSE2__
+#include <emmintrin.h> // For `_applyFixups`
+#endif
 #if defined(__BYTE_ORDER) && __BYTE_ORDER == __BIG_ENDIAN || \
     defined(__BIG_ENDIAN__) || \
     defined(__ARMEB__) || \
@@ -62,50 +78,71 @@ int _open(const char *pathname, int flags) {
   }
   return fd;
 }
-ssize_t _read(int fd, void* buf, size_t count) {
-  ssize_t ret = read(fd, buf, count);
+int _close(int fd) {
+  ioStats().forgetFd(fd);
+  int ret = close(fd);
   if (ret == -1) {
-    perror("read failed");
-    throw errno;
-  }
-  else if ((size_t)ret < count) {
-    perror("read got too few bytes");
+    perror("close failed");
     throw errno;
   }
   return ret;
 }
-unsigned long long g_seekBase = 0;
-void _lseek_setSeekBase(unsigned long long seekInFD) {
-  g_seekBase = seekInFD;
+
+// Engine used to read many extents at once (see readEngine.hpp), shared by all `Volume`s. Made on first use.
+unsigned g_readQueueDepth = 32;
+std::unique_ptr<ReadEngine> g_readEngine;
+std::mutex g_readEngineMutex;
+// Sets how many reads the read engine may have in flight at once. Call this before any reading.
+void _setReadQueueDepth(unsigned queueDepth) {
+  std::lock_guard<std::mutex> lock(g_readEngineMutex);
+  g_readQueueDepth = queueDepth;
+  g_readEngine.reset();
 }
-off_t _lseek(int fd, off_t offset, int whence) {
-  // Get current offset
-  off_t origOffsetFromStartOfFile = lseek(fd, 0, SEEK_CUR); // (Shouldn't change the offset in the file, but returns the offset from the start as lseek usually does.)
-  if (origOffsetFromStartOfFile == -1) {
-    perror("lseek to get current offset failed");
-    throw errno;
+ReadEngine& _readEngine() {
+  std::lock_guard<std::mutex> lock(g_readEngineMutex);
+  if (g_readEngine == nullptr) {
+    g_readEngine = makeReadEngine(g_readQueueDepth);
+    LOG(LOG_INFO, "Using the %s read engine with a queue depth of %u\n", g_readEngine->name(), g_readQueueDepth);
   }
-  
-  off_t ret = lseek(fd, (whence == SEEK_SET ? g_seekBase : 0) + offset, whence);
-  off_t desired;
-  if (ret == -1) {
-    perror("lseek failed");
-    throw errno;
+  return *g_readEngine;
+}
+// Requests whose file ranges are at most this many bytes apart are merged into one vectored read by `_readAll` (see `coalesceRequests`). 0 only merges requests that are exactly adjacent.
+size_t g_coalesceGapThreshold = 64 * 1024;
+void _setCoalesceGapThreshold(size_t bytes) {
+  g_coalesceGapThreshold = bytes;
+}
+// Reads all of `requests` (whose offsets are from the start of the file) from `fd` with the read engine, or directly if there is only one after merging the ones that are close together. If `fd` was opened with O_DIRECT, pass the pool to make the reads aligned with (see `readAllDirect`), otherwise nullptr, and the size of the file if it is a regular file (so the aligned reads can stop at its end).
+void _readAll(int fd, const std::vector<ReadRequest>& requests, AlignedBufferPool* directIOBufferPool, off_t fileSize = 0) {
+  CoalescedRequests coalesced;
+  coalesceRequests(requests, g_coalesceGapThreshold, coalesced);
+  if (coalesced.requests.size() < requests.size()) {
+    LOG(LOG_DEBUG, "_readAll: coalesced %zu reads into %zu\n", requests.size(), coalesced.requests.size());
   }
-  else if ((whence == SEEK_CUR && ret != (desired=origOffsetFromStartOfFile + offset)) ||
-	   (whence == SEEK_SET && ret != (desired=offset+g_seekBase))) {
-    fprintf(stderr, "lseek didn't go to the expected offset: expected %jd but got %jd\n", (intmax_t)desired, (intmax_t)ret);
-    throw errno;
+  SyncReadEngine syncEngine;
+  ReadEngine& engine = coalesced.requests.size() == 1 ? syncEngine : _readEngine();
+  if (directIOBufferPool != nullptr) {
+    readAllDirect(engine, *directIOBufferPool, fd, coalesced.requests, fileSize);
+  }
+  else {
+    engine.readAll(fd, coalesced.requests);
   }
-  return ret;
 }
-int _close(int fd) {
-  int ret = close(fd);
-  if (ret == -1) {
-    perror("close failed");
-    throw errno;
+
+// Pool that the volumes found by `_findNTFSVolumes` are scanned on, one task each (see `main`). Made on first use.
+std::unique_ptr<ThreadPool> g_threadPool;
+std::mutex g_threadPoolMutex;
+ThreadPool& _threadPool() {
+  std::lock_guard<std::mutex> lock(g_threadPoolMutex);
+  if (g_threadPool == nullptr) {
+    g_threadPool.reset(new ThreadPool());
   }
-  return ret;
+  return *g_threadPool;
+}
+
+// Default `MyDataRuns::prefetchWindow`.
+size_t g_prefetchWindow = 4;
+void _setPrefetchWindow(size_t runs) {
+  g_prefetchWindow = runs;
 }
 
 // //
@@ -186,21 +223,6 @@ struct free_delete
 template <typename T>
 using unique_free = std::unique_ptr<T, free_delete>;
 
-// For GMP library-allocated buffers
-struct free_mp
-{
-  size_t wordCount, wordSize;
-  void operator()(void* outRaw) {
-    // https://stackoverflow.com/questions/51601666/gmp-store-64-bit-interger-in-mpz-t-mpz-class-and-get-64-bit-integers-back
-    // Free the allocated memory by mpz_export
-    void (*freeFunction)(void*, size_t);
-    mp_get_memory_functions(nullptr, nullptr, &freeFunction);
-    freeFunction(outRaw, wordCount * wordSize);
-  }
-};
-template <typename T>
-using unique_free_mp = std::unique_ptr<T, free_mp>;
-
 // https://stackoverflow.com/questions/41744559/is-this-a-bug-of-gcc : {"
 // Also see LWG issue 721 [ http://www.open-std.org/jtc1/sc22/wg21/docs/lwg-closed.html#721 ] (decided as Not A Defect).
 //   "This is a regrettable consequence of the original design of the facet."
@@ -455,31 +477,226 @@ public:
     return get();
   }
 };
-struct RunList; struct NTFS;
+struct RunList; struct NTFS; struct Volume;
 
 #pragma pack()
 // Non-NTFS-specific struct
 struct MyDataRun {
-  size_t offset; // Offset in clusters from the start of the volume *or* previous data run's start if there is a previous one.
+  int64_t offset; // Offset in clusters from the start of the volume *or* previous data run's start if there is a previous one (so it can be negative). Sparse runs have nothing on disk, so theirs only matters for where the runs after them are.
   size_t length; // Length in clusters of this run. If this is zero, ignore it.
+  bool sparse = false; // Whether this run has no clusters on disk (see RunList::isSparse())
 };
 #pragma pack(1)
 #pragma pack()
+// Non-NTFS-specific struct. A run with its position resolved, so that it can be found without walking the runs before it.
+struct MyRunExtent {
+  uint64_t vcn; // First VCN (virtual cluster number, i.e. cluster within the data) of this run
+  int64_t lcn; // First LCN (logical cluster number, i.e. cluster within the volume) of this run
+  uint64_t length; // In clusters
+  bool sparse;
+};
+// Walks a RunList one run at a time, remembering where it got to, so that loading more of the runs only decodes the new ones instead of starting over from the first entry.
+struct RunListCursor {
+  RunList* runList; // The next entry to decode, or nullptr if there are no more
+  const uint8_t* end; // End of the attribute the RunList is in. No entry is decoded past it.
+  uint64_t vcn = 0; // VCN at which the next run starts
+  int64_t lcn = 0; // LCN of the start of the last run returned, which the next run's offset is relative to
+  uint64_t remainingInRun = 0; // Clusters of the last decoded entry that haven't been returned yet because of `maxLength`
+  bool sparse = false; // Whether the last decoded entry is sparse
+  uint64_t lastLength = 0; // Length of the last run returned
+  int64_t runStartLCN = 0; // LCN of the start of the last decoded entry
+  bool corrupt = false; // Whether the walk stopped at an entry that doesn't fit before `end` (see `RunList::fitsBefore`) rather than at the terminator
+
+  bool atEnd() const { return runList == nullptr && remainingInRun == 0; }
+
+  // Sets `out` to the next run, or at most `maxLength` clusters of it (the rest is returned by the next call). Returns false if there are no more runs, or if the next entry is corrupt, in which case `corrupt` is set.
+  bool next(MyDataRun* out, uint64_t maxLength = UINT64_MAX);
+};
+// Non-NTFS-specific struct. A single read to make: a contiguous range of the volume that goes to a contiguous range of a buffer. Or, if `hole` is set, a range of the buffer that is all zeroes without anything being read (from a sparse run).
+struct MyExtent {
+  off_t offsetInVolume; // In bytes. Unused if `hole`.
+  size_t offsetInBuf; // In bytes
+  size_t length; // In bytes
+  bool hole = false;
+};
+// Non-NTFS-specific struct. A std::atomic<size_t> that can be copied (not atomically), so that the structs holding one can be too.
+struct CopyableAtomicSize {
+  std::atomic<size_t> value;
+
+  CopyableAtomicSize(size_t value_ = 0) : value(value_) {}
+  CopyableAtomicSize(const CopyableAtomicSize& other) : value(other.value.load(std::memory_order_relaxed)) {}
+  CopyableAtomicSize& operator=(const CopyableAtomicSize& other) {
+    value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+  }
+};
 // Non-NTFS-specific struct
 struct MyDataRuns {
   std::vector<MyDataRun> dataRuns;
+  std::vector<MyRunExtent> index; // `dataRuns` decoded into absolute positions, in order of VCN (so sorted by it), skipping runs of length 0. Kept up to date by `append`.
+  uint64_t baseVCN = 0; // VCN of the start of the first of `dataRuns` (not 0 once `dropBefore` has been used)
+  int64_t endLCN = 0; // LCN of the start of the last of `dataRuns`, which the next run's offset is relative to
+  std::optional<RunListCursor> cursor; // Where the rest of the runs are, if they came from a RunList (see `extendTo`)
   bool hasMore; // Whether the last run has more data to it but it wasn't loaded, or there are more runs to be loaded but they weren't loaded.
+  size_t prefetchWindow = g_prefetchWindow; // How many runs past what `load` or `view` was asked for to hint to the kernel to start reading in the background (0 to disable). See `prefetch`.
+  mutable CopyableAtomicSize prefetchedUpTo; // Offset in bytes within the data up to which `prefetch` has already given hints, so they aren't given again. Atomic since `prefetch` is called from const methods, which several threads may be in at once.
+
+  // Hints to the kernel that the `prefetchWindow` runs from byte `fromOffset` onwards will be read soon (see `Volume::prefetch`), so that sequential walks don't stall at the start of each run. Called by `load` and `view` for what comes after what they were asked for.
+  void prefetch(size_t fromOffset, const Volume& volume) const;
+
+  // Adds `dr` after the last of `dataRuns`, and to `index` unless it is of length 0. This is the only way runs are added, so `index` always matches `dataRuns`.
+  void append(const MyDataRun& dr);
+
+  // Returns the index into `index` of the run containing `vcn`, or `index.size()` if it is past the end of the runs. O(log runs).
+  size_t findRun(uint64_t vcn) const;
+
+  // Sets `out_lcn` to the LCN that `vcn` is stored at. Returns false if `vcn` is past the end of the runs.
+  bool lcnOf(uint64_t vcn, int64_t* out_lcn) const;
+
+  // VCN just past the end of the loaded runs, i.e. their total length in clusters (including any dropped by `dropBefore`).
+  uint64_t endVCN() const {
+    return index.empty() ? baseVCN : index.back().vcn + index.back().length;
+  }
+
+  // Decodes more runs from `cursor` until `endVCN()` reaches `vcn` or the runs run out, only decoding the ones that aren't loaded yet. Updates `hasMore`.
+  void extendTo(uint64_t vcn);
+
+  // Forgets the runs that end at or before `vcn`, so that streaming through a huge attribute (such as the MFT of a volume with millions of files) with `extendTo` doesn't hold all of its runs at once. Data before `vcn` can't be read afterwards.
+  void dropBefore(uint64_t vcn);
+
+  // Returns the extents of the volume that make up bytes [bufOffset, bufOffset + amountToLoad) of the data described by dataRuns, in order (but at most `maxExtents` of them). `out_endOfRuns` is set to the total length in bytes of dataRuns. This finds the first run with a binary search on `index`, so it costs O(log runs) plus the number of extents returned.
+  std::vector<MyExtent> plan(size_t bufOffset, size_t amountToLoad, const Volume& volume, size_t* out_endOfRuns, size_t maxExtents = SIZE_MAX) const;
 
   // Loads data from the dataRuns' specified offsets and lengths. See the definition of this function for more information.
-  unique_free<void*> load(size_t bufOffset, void* buf, size_t amountToLoad, int fd, const NTFS* ntfs, bool* out_moreNeeded, ssize_t* out_more) const;
+  unique_free<void*> load(size_t bufOffset, void* buf, size_t amountToLoad, const Volume& volume, bool* out_moreNeeded, ssize_t* out_more) const;
+
+  // Reads bytes [offset, offset + length) of the data described by dataRuns into the start of `buf` (unlike `load`, which puts them at `buf + bufOffset`), zeroing the parts in holes, so that a large attribute can be read piece by piece into the same buffer. Returns how many bytes were read, which is less than `length` if the runs ran out.
+  size_t readInto(void* buf, size_t offset, size_t length, const Volume& volume) const;
+
+  // Like `readInto` but adds the reads to `requests` for the caller to issue with `Volume::readAll` (holes are zeroed right away), so that several ranges can be read at once. `buf` is where byte `offset` goes.
+  size_t planReads(void* buf, size_t offset, size_t length, const Volume& volume, std::vector<ReadRequest>& requests) const;
+
+  // Like `load` but returns a pointer into the memory-mapped file (see `Volume::view`) instead of copying, or nullptr if that isn't possible (the volume isn't mapped or the runs involved aren't physically contiguous). The pointer points at the data for `bufOffset` and must not be freed.
+  void* view(size_t bufOffset, size_t amountToLoad, const Volume& volume, bool* out_moreNeeded, ssize_t* out_more) const;
+};
+
+// Non-NTFS-specific struct. The runs of many attributes (e.g. every file's $DATA on a volume, see `analyzeFragmentation`) packed into one shared arena, for when they need to be kept around: each run is a varint of its LCN relative to the previous run's, then a varint of its length (shifted left one bit to make room for the sparse flag), so most runs take 2 to 4 bytes instead of the 24 of a MyDataRun plus a vector per attribute. Decode them on demand with `Iterator`.
+// `encode` can be called from several threads at once, so that the encoding can be spread out, but `add` can only be called from one thread at a time and not while other threads are reading the store.
+struct MyCompactRuns {
+  std::vector<uint8_t> arena;
+  std::vector<size_t> starts; // Offset within `arena` of each added attribute's runs, indexed by the id returned by `add`. They end where the next one starts (or at the end of `arena`).
+
+  // Decodes the runs of one attribute in order, as MyRunExtents.
+  class Iterator {
+  public:
+    Iterator(const uint8_t* p_, const uint8_t* end_): p(p_), end(end_) {
+      vcn = readVarint();
+    }
+
+    // Sets `out` to the next run. Returns false if there are no more.
+    bool next(MyRunExtent* out) {
+      if (p >= end) {
+	return false;
+      }
+      lcn += unzigzag(readVarint());
+      uint64_t lengthAndFlag = readVarint();
+      *out = {vcn, lcn, lengthAndFlag >> 1, (lengthAndFlag & 1) != 0};
+      vcn += out->length;
+      return true;
+    }
+
+    // VCN of the start of the next run
+    uint64_t nextVCN() const { return vcn; }
+
+  protected:
+    const uint8_t* p;
+    const uint8_t* end;
+    uint64_t vcn;
+    int64_t lcn = 0;
+
+    uint64_t readVarint() {
+      uint64_t ret = 0;
+      for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+	uint8_t byte = *p++;
+	ret |= (uint64_t)(byte & 0x7f) << shift;
+	if ((byte & 0x80) == 0) {
+	  break;
+	}
+      }
+      return ret;
+    }
+  };
+
+  // Encodes the runs of `runs` (from its `index`, so runs of length 0 are left out) for `add`. Decode the result with `Iterator(encoded.data(), encoded.data() + encoded.size())`.
+  static std::vector<uint8_t> encode(const MyDataRuns& runs) {
+    std::vector<uint8_t> encoded;
+    encoded.reserve(1 + runs.index.size() * 4);
+    writeVarint(encoded, runs.index.empty() ? runs.baseVCN : runs.index[0].vcn);
+    int64_t lcn = 0;
+    for (const MyRunExtent& e : runs.index) {
+      writeVarint(encoded, zigzag(e.lcn - lcn));
+      writeVarint(encoded, (e.length << 1) | (e.sparse ? 1 : 0));
+      lcn = e.lcn;
+    }
+    assert(decodesTo(encoded, runs));
+    return encoded;
+  }
+
+  // Stores runs encoded by `encode`. Returns the id to look them up by.
+  size_t add(const std::vector<uint8_t>& encoded) {
+    starts.push_back(arena.size());
+    arena.insert(arena.end(), encoded.begin(), encoded.end());
+    return starts.size() - 1;
+  }
+
+  Iterator runs(size_t id) const {
+    const uint8_t* start = arena.data() + starts[id];
+    const uint8_t* end = arena.data() + (id + 1 < starts.size() ? starts[id + 1] : arena.size());
+    return Iterator(start, end);
+  }
+
+  size_t size() const { return starts.size(); }
+
+  // Bytes used by the store, to compare with keeping MyDataRuns around
+  size_t memoryUsage() const {
+    return arena.capacity() + starts.capacity() * sizeof(size_t);
+  }
+
+  // Whether `encoded` decodes back into exactly the runs of `runs`, i.e. that encoding them lost nothing (checked by `encode` in debug builds).
+  static bool decodesTo(const std::vector<uint8_t>& encoded, const MyDataRuns& runs) {
+    Iterator it(encoded.data(), encoded.data() + encoded.size());
+    MyRunExtent e;
+    for (const MyRunExtent& expected : runs.index) {
+      if (!it.next(&e) || e.vcn != expected.vcn || e.lcn != expected.lcn || e.length != expected.length || e.sparse != expected.sparse) {
+	return false;
+      }
+    }
+    return !it.next(&e) && it.nextVCN() == runs.endVCN();
+  }
+
+protected:
+  static uint64_t zigzag(int64_t x) { return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); } // Small negative numbers become small positive ones, so relative LCNs before the previous run stay short too
+  static int64_t unzigzag(uint64_t x) { return (int64_t)(x >> 1) ^ -(int64_t)(x & 1); }
+
+  static void writeVarint(std::vector<uint8_t>& out, uint64_t x) {
+    while (x >= 0x80) {
+      out.push_back((uint8_t)(x | 0x80));
+      x >>= 7;
+    }
+    out.push_back((uint8_t)x);
+  }
 };
 #pragma pack(1)
 
 struct LazilyLoaded {
   RunList* runList; // The "lazy loader"
+  const uint8_t* end; // End of the attribute `runList` is in (see `RunListCursor::end`)
+  MyDataRuns loaded; // What `loadUpTo` has decoded so far, with the cursor to carry on from
+
+  LazilyLoaded(RunList* runList_, const uint8_t* end_): runList(runList_), end(end_) {}
 
-  // Using `runList`, "loads" (doesn't actually read from disk though) MyDataRuns up to and including totalOffsetFromStartInClusters (tip to specify in bytes: try passing in totalOffsetFromStartInClusters = x / `NTFS.bytesPerCluster()` where x is the number of bytes to load up to (and is a multiple of bytesPerCluster() -- round up to it if needed)). If there is more available but it isn't loaded, the returned MyDataRuns object will have hasMore set to true. You can call this function again with a larger totalOffsetFromStartInClusters to fix this.
-  MyDataRuns loadUpTo(size_t totalOffsetFromStartInClusters) const;
+  // Using `runList`, "loads" (doesn't actually read from disk though) MyDataRuns up to and including totalOffsetFromStartInClusters (tip to specify in bytes: try passing in totalOffsetFromStartInClusters = x / `NTFS.bytesPerCluster()` where x is the number of bytes to load up to (and is a multiple of bytesPerCluster() -- round up to it if needed)). If there is more available but it isn't loaded, the returned MyDataRuns object will have hasMore set to true. Calling this again with a bigger limit carries on from where the last call stopped (see `MyDataRuns::extendTo`), so only the new runs are decoded; runs that have been dealt with can be let go of in between with `loaded.dropBefore`.
+  const MyDataRuns& loadUpTo(size_t totalOffsetFromStartInClusters);
 };
 //using NonResidentAttributeContent = LazilyLoaded;
 
@@ -491,7 +708,16 @@ struct ResidentAttribute {
   uint8_t indexedFlag; // ntfsdoc-0.6/concepts/attribute_header.html
   char padding[1]; // ntfsdoc-0.6/concepts/attribute_header.html
 
-  std::pair<AttributeContent, std::optional<MyDataRuns> /*placeholder, will be empty*/> content(.../*<--placeholder for std::visit, ignore this*/) const {
+  // Returns a pointer to the content, or nullptr if the content doesn't fit within `base.attributeLength` (a corrupt attribute) or is smaller than `minSize`. Unlike `content()`, this works for any type of attribute.
+  uint8_t* boundedContent(size_t minSize = 0) const {
+    if (sizeOfContent < minSize || offsetToContent > base.attributeLength || sizeOfContent > base.attributeLength - offsetToContent) {
+      return nullptr;
+    }
+    return (uint8_t*)this + offsetToContent;
+  }
+
+  template <typename... Args>
+  std::pair<AttributeContent, std::optional<MyDataRuns> /*placeholder, will be empty*/> content(const Args&.../*<--placeholder for std::visit, ignore this*/) const {
     uint8_t* contentPtr = (uint8_t*)this + offsetToContent;
     switch (base.typeIdentifier) {
     case STANDARD_INFORMATION:
@@ -506,87 +732,6 @@ struct ResidentAttribute {
   }
 };
 
-// Wrapper for a GMP multi-precision integer ("z").
-struct MPZWrapper {
-  mpz_t z;
-  bool initted;
-  MPZWrapper() { mpz_init(z); initted = true; }
-  MPZWrapper(mpz_t&& z_) { memcpy(&z, &z_, sizeof(mpz_t)); initted = true; } // Takes ownership
-  MPZWrapper(MPZWrapper&& o) { memcpy(&z, &o.z, sizeof(mpz_t)); initted = true; o.initted = false; }
-  MPZWrapper(const MPZWrapper& o) {
-    if (o.initted) {
-      mpz_init(z);
-      initted = true;
-      mpz_set(z, o.z); // Copy it over from `o`
-    }
-    else {
-      initted = false;
-    }
-  }
-  ~MPZWrapper() { if (initted) mpz_clear(z); /* Free it */ }
-
-  MPZWrapper& operator=(const MPZWrapper& o) {
-    if (o.initted) {
-      if (!initted) mpz_init(z);
-      initted = true;
-      mpz_set(z, o.z); // Copy it over from `o`
-    }
-    else {
-      if (initted) mpz_clear(z); /* Free it */
-      initted = false;
-    }
-    return *this;
-  }
-
-  MPZWrapper(const uint8_t* source, size_t length) {
-    mpz_init(z);
-    initted = true;
-    
-    // https://gmplib.org/manual/Useful-Macros-and-Constants
-    //static_assert(mp_bits_per_limb == sizeof(mp_limb_t) * CHAR_BIT); // Untested
-    // https://gmplib.org/manual/Initializing-Integers
-    //mpz_init2(z, (length + sizeof(mp_limb_t)) * CHAR_BIT); // CHAR_BIT is bits in a byte
-    // https://gmplib.org/manual/Integer-Import-and-Export#Integer-Import-and-Export , https://stackoverflow.com/questions/6683773/how-to-initialize-a-mpz-t-in-gmp-with-a-1024-bit-number-from-a-character-string
-    printf("MPZWrapper::MPZWrapper: importing: "); DumpHex(source, length);
-    mpz_import(z, length /*count (in words)*/, -1 /*order*/, sizeof(uint8_t) /*each word's size in bytes*/, 0 /*endian*/, 0 /*nails*/, source); // "There is no sign taken from the data, rop will simply be a positive integer. An application can handle any sign itself, and apply it for instance with mpz_neg." ( https://gmplib.org/manual/Integer-Import-and-Export )
-    gmp_printf ("MPZWrapper::MPZWrapper: imported mpz_t: %Zu\n", z);
-  }
-
-  size_t toSizeT() const {
-    assert(initted);
-    
-    //if (mpz_fits_ulong_p(z.z)) { // Then this fits in an unsigned long int.
-    //static_assert(sizeof(unsigned long int) >= sizeof(size_t));
-
-    size_t bytesNeededForZ = integerDivisionRoundingUp(mpz_sizeinbase(z, 2), (size_t)CHAR_BIT); // Convert bits to bytes, rounding up so we know it can be stored
-    printf("MPZWrapper::toSizeT: bytesNeededForZ: %ju, sizeof(size_t): %ju\n", (uintmax_t)bytesNeededForZ, (uintmax_t)sizeof(size_t));
-    assert(bytesNeededForZ <= sizeof(size_t));
-    //size_t builtInSizeT;
-    //mpz_import(z, 1, 1, sizeof(size_t), 0, 0, &builtInSizeT);
-
-    constexpr size_t wordSize = 1;
-    size_t wordCount;
-    constexpr size_t maxWordCount = sizeof(size_t);
-    void* buf = (void*)mpz_export(nullptr, &wordCount, -1, wordSize, 0, 0, z); // "The sign of `op` [`z`] is ignored, just the absolute value is exported. An application can use mpz_sgn to get the sign and handle it as desired. (see Section 5.10 [Integer Comparisons] [ https://gmplib.org/manual/Integer-Comparisons.html ], page 39)" ( https://gmplib.org/manual/Integer-Import-and-Export + pdf manual )
-    unique_free_mp<void*> outRaw((void**)buf,
-				 free_mp{wordCount, wordSize});
-    printf("MPZWrapper::toSizeT: wordCount = %ju, maxWordCount = %ju\n", (uintmax_t)wordCount, (uintmax_t)maxWordCount);
-    assert(wordCount <= maxWordCount); // Make sure that our integer type can still hold the value
-    printf("MPZWrapper::toSizeT: result before realloc: "); DumpHex(outRaw.get(), wordCount);
-
-    void* (*reallocFunction)(void*, size_t, size_t);
-    mp_get_memory_functions(nullptr, &reallocFunction, nullptr);
-    outRaw.reset((void**)reallocFunction((void*)outRaw.release(), wordCount * wordSize, maxWordCount * wordSize)); // buf, old size, new size
-    buf = (void*)outRaw.get();
-    // Zero out the rest
-    memset((uint8_t*)buf + (wordCount * wordSize), 0, (maxWordCount * wordSize - wordCount * wordSize)); 
-    printf("MPZWrapper::toSizeT: result after realloc: "); DumpHex(outRaw.get(), maxWordCount);
-    
-    const size_t out = *(size_t*)(outRaw.get());
-    return out;
-  }
-};
-
 // This struct describes ntfsdoc-0.6/concepts/data_runs.html
 struct RunList {
   uint8_t header; // This header tells you (via the two nibbles of this header byte) how large the `offset()` and `length()` values are, respectively. After these offset() and length() values is 0x00, a null byte to terminate the RunList.
@@ -599,22 +744,53 @@ struct RunList {
     return header >> 4;
   }
 
+  // Reads the `size`-byte little-endian unsigned integer at `value`. The fields of a RunList are at most 8 bytes, since lengths and LCNs are 64-bit.
+  static uint64_t loadLittleEndian(const uint8_t* value, size_t size) {
+    if (size > sizeof(uint64_t)) {
+      LOG(LOG_ERROR, "RunList::loadLittleEndian: field of %zu bytes is too large\n", size);
+      throw UnhandledValue();
+    }
+    uint64_t ret = 0;
+    memcpy(&ret, value, size); // (The CPU is little-endian, which is checked at the top of this file)
+    return ret;
+  }
+
   // Returns the length of the clusters pointed to by this RunList, in clusters.
-  MPZWrapper length() const {
-    uint8_t* value = (uint8_t*)this + sizeof(RunList().header);
-    size_t length = sizeOfLength();
-    printf("RunList::length(): "); DumpHex(value, length);
-    MPZWrapper z(value, length);
-    return z;
+  uint64_t length() const {
+    return loadLittleEndian((uint8_t*)this + sizeof(RunList().header), sizeOfLength());
+  }
+
+  // Returns the offset of the clusters pointed to by this RunList, in LCNs (logical cluster numbers). This offset is from the start of the NTFS volume *if* this is the first entry in the RunList; otherwise, this is the offset from the `offset()` of the previous entry in the RunList, and can be negative ("The offset is a signed value" -- ntfsdoc-0.6/concepts/data_runs.html ). 0 if `isSparse()`.
+  int64_t offset() const {
+    size_t size = sizeOfOffset();
+    uint64_t value = loadLittleEndian((uint8_t*)this + sizeof(RunList().header) + sizeOfLength(), size);
+    if (size == 0) {
+      return 0;
+    }
+    // Sign-extend from the top bit of the field
+    unsigned shift = 64 - size * CHAR_BIT;
+    return (int64_t)(value << shift) >> shift;
+  }
+
+  // Whether this run has no clusters on disk (it has an offset of size 0), meaning its clusters read as zeroes. ( ntfsdoc-0.6/concepts/data_runs.html : "Sparse files" )
+  bool isSparse() const {
+    return sizeOfOffset() == 0;
   }
 
-  // Returns the offset of the clusters pointed to by this RunList, in LCNs (logical cluster numbers). This offset is from the start of the NTFS volume *if* this is the first entry in the RunList; otherwise, this is the offset from the `offset()` of the previous entry in the RunList.
-  MPZWrapper offset() const {
-    uint8_t* value = (uint8_t*)this + sizeof(RunList().header) + sizeOfLength();
-    size_t length = sizeOfOffset();
-    printf("RunList::offset(): "); DumpHex(value, length);
-    MPZWrapper z(value, length);
-    return z;
+  // Whether this entry lies before `end`, along with the header byte after it (the next entry's or the terminating 0x00), and its fields are at most 8 bytes each, so that decoding it and calling `next()` stay within the attribute and don't throw. Corrupt records can have anything here.
+  bool fitsBefore(const uint8_t* end) const {
+    const uint8_t* start = (const uint8_t*)this;
+    return start < end && sizeOfLength() <= sizeof(uint64_t) && sizeOfOffset() <= sizeof(uint64_t) && (size_t)(end - start) > sizeof(header) + sizeOfLength() + sizeOfOffset();
+  }
+
+  // Whether every entry of the RunList starting at `first` passes `fitsBefore(end)`, up to and including its terminator. Only looks at the header bytes, without decoding any runs, so it is cheap enough to check every record of a scan with (see `_checkRecordAttributes`).
+  static bool isValid(const RunList* first, const uint8_t* end) {
+    for (const RunList* rl = first; rl != nullptr; rl = rl->next()) {
+      if (!rl->fitsBefore(end)) {
+	return false;
+      }
+    }
+    return true;
   }
 
   // Returns the next entry of this RunList, or nullptr if this is the last one.
@@ -627,32 +803,92 @@ struct RunList {
   }
 };
 
-MyDataRuns LazilyLoaded::loadUpTo(size_t totalOffsetFromStartInClusters) const {
-  // Accumulate offsets
-  MyDataRuns dataRuns;
-  size_t counter = 0, offsetCounter = 0;
-  for (RunList* rl = runList; rl != nullptr; rl = rl->next()) {
-    MPZWrapper z = runList->offset();
-    size_t offset = z.toSizeT();
-    z = runList->length();
-    size_t length = z.toSizeT();
-    printf("LazilyLoaded::loadUpTo: processing RunList: offset size = %ju, length size = %ju, offset = %ju, length = %ju\n", (uintmax_t)runList->sizeOfOffset(), (uintmax_t)runList->sizeOfLength(), (uintmax_t)offset, (uintmax_t)length);
-
-    counter += length;
-    offsetCounter += offset;
-    dataRuns.dataRuns.push_back({
-	.offset = offset,
-	.length = counter >= totalOffsetFromStartInClusters ? counter - totalOffsetFromStartInClusters : length
-      });
-    dataRuns.hasMore = counter > totalOffsetFromStartInClusters; // || rl->next() != nullptr;
-    if (counter >= totalOffsetFromStartInClusters) {
-      // Done loading
-      printf("LazilyLoaded::loadUpTo: done loading: counter %ju, totalOffsetFromStartInClusters %ju, rl->next() %p\n", (uintmax_t)counter, (uintmax_t)totalOffsetFromStartInClusters, rl->next()); // if (rl->next() != nullptr || counter > totalOffsetFromStartInClusters) then more is left to load!
+bool RunListCursor::next(MyDataRun* out, uint64_t maxLength) {
+  if (remainingInRun == 0) {
+    if (runList == nullptr) {
+      return false;
+    }
+    RunList* rl = runList;
+    if (!rl->fitsBefore(end)) {
+      LOG(LOG_WARN, "RunListCursor::next: corrupt RunList entry with header %#x at %td bytes before the end of its attribute\n", (unsigned)rl->header, end - (const uint8_t*)rl);
+      corrupt = true;
+      runList = nullptr;
+      return false;
+    }
+    int64_t offset = rl->offset();
+    uint64_t length = rl->length();
+    sparse = rl->isSparse();
+    LOG(LOG_TRACE, "RunListCursor::next: processing RunList: offset size = %ju, length size = %ju, offset = %jd, length = %ju%s\n", (uintmax_t)rl->sizeOfOffset(), (uintmax_t)rl->sizeOfLength(), (intmax_t)offset, (uintmax_t)length, sparse ? " (sparse)" : "");
+    runList = rl->next();
+    uint64_t taken = std::min(length, maxLength);
+    // `offset` is relative to the start of the previous entry, which isn't the start of the last run returned if that entry was split
+    runStartLCN += offset;
+    *out = {runStartLCN - lcn, taken, sparse};
+    lcn = runStartLCN;
+    lastLength = taken;
+    remainingInRun = length - taken;
+    vcn += taken;
+    return true;
+  }
+
+  // The rest of a run split by an earlier `maxLength`. It continues right after the part already returned, so relative to it its offset is that part's length (sparse runs don't have an LCN, so theirs stays 0).
+  uint64_t taken = std::min(remainingInRun, maxLength);
+  int64_t offset = sparse ? 0 : (int64_t)lastLength;
+  *out = {offset, taken, sparse};
+  lcn += offset;
+  lastLength = taken;
+  remainingInRun -= taken;
+  vcn += taken;
+  return true;
+}
+
+void MyDataRuns::append(const MyDataRun& dr) {
+  dataRuns.push_back(dr);
+  endLCN += dr.offset; // Each run's offset is relative to the previous run's
+  if (dr.length != 0) {
+    index.push_back({endVCN(), endLCN, dr.length, dr.sparse});
+  }
+}
+
+void MyDataRuns::dropBefore(uint64_t vcn) {
+  size_t dropIndex = 0;
+  while (dropIndex < index.size() && index[dropIndex].vcn + index[dropIndex].length <= vcn) {
+    dropIndex++;
+  }
+  if (dropIndex == 0) {
+    return;
+  }
+  // Drop the same runs from `dataRuns`, including any of length 0 among them
+  size_t dropRuns = 0, nonEmpty = 0;
+  while (dropRuns < dataRuns.size() && nonEmpty < dropIndex) {
+    if (dataRuns[dropRuns].length != 0) {
+      nonEmpty++;
+    }
+    dropRuns++;
+  }
+  baseVCN = index[dropIndex-1].vcn + index[dropIndex-1].length;
+  index.erase(index.begin(), index.begin() + dropIndex);
+  dataRuns.erase(dataRuns.begin(), dataRuns.begin() + dropRuns);
+}
+
+void MyDataRuns::extendTo(uint64_t vcn) {
+  while (cursor.has_value() && endVCN() < vcn) {
+    MyDataRun dr;
+    if (!cursor->next(&dr, vcn - endVCN())) {
       break;
     }
+    append(dr);
   }
+  hasMore = cursor.has_value() && !cursor->atEnd();
+}
 
-  return dataRuns;
+const MyDataRuns& LazilyLoaded::loadUpTo(size_t totalOffsetFromStartInClusters) {
+  if (!loaded.cursor.has_value()) {
+    loaded.cursor = RunListCursor{runList, end};
+  }
+  loaded.extendTo(totalOffsetFromStartInClusters);
+  LOG(LOG_DEBUG, "LazilyLoaded::loadUpTo: done loading: %ju clusters in %zu runs, totalOffsetFromStartInClusters %ju, hasMore %s\n", (uintmax_t)loaded.endVCN(), loaded.dataRuns.size(), (uintmax_t)totalOffsetFromStartInClusters, loaded.hasMore ? "true" : "false");
+  return loaded;
 }
 
 // "non-resident attributes need to describe an arbitrary number of cluster runs, consecutive clusters that they occupy."
@@ -667,7 +903,7 @@ struct NonResidentAttribute {
   uint64_t actualSizeOfTheAttributeContent;
   uint64_t initializedSizeOfTheAttributeContent; // "Compressed data size." ( ntfsdoc-0.6/concepts/attribute_header.html )
 
-  Pair<AttributeContentWithFreer, std::optional<MyDataRuns>> content(size_t limitToLoad, bool* out_moreNeeded, ssize_t* out_more, int fd, const NTFS* ntfs) const;
+  Pair<AttributeContentWithFreer, std::optional<MyDataRuns>> content(size_t limitToLoad, bool* out_moreNeeded, ssize_t* out_more, const Volume& volume) const;
 };
 
 using Attribute = std::variant<ResidentAttribute*, NonResidentAttribute*>;
@@ -682,6 +918,52 @@ Attribute makeAttribute(AttributeBase* base) {
   }
 }
 
+// Walks the attribute headers of an MFTRecord in place, without allocating. It stops (becomes equal to the end iterator) at the end-of-attributes marker, or at the first header that doesn't fit within the record's used size or has a length too small to move past it, so that a corrupt record can't make it run off the end or loop forever.
+struct AttributeIterator {
+  AttributeBase* attr; // nullptr if this is the end
+  const uint8_t* end; // End of the used part of the record
+
+  AttributeIterator(AttributeBase* attr_, const uint8_t* end_): attr(attr_), end(end_) {
+    check();
+  }
+
+  AttributeIterator& operator++() {
+    attr = (AttributeBase*)((uint8_t*)attr + attr->attributeLength);
+    check();
+    return *this;
+  }
+
+  AttributeBase* operator*() const { return attr; }
+  AttributeBase* operator->() const { return attr; }
+
+  // Makes this the end iterator if `attr` isn't a whole attribute header within the record.
+  void check() {
+    if (attr == nullptr) {
+      return;
+    }
+    size_t remaining = (const uint8_t*)attr < end ? end - (const uint8_t*)attr : 0;
+    if (remaining < sizeof(uint32_t) || attr->typeIdentifier == 0xffffffff // The end marker for attribute list
+	|| remaining < sizeof(AttributeBase) || attr->attributeLength < sizeof(AttributeBase) || attr->attributeLength > remaining) {
+      attr = nullptr;
+    }
+  }
+};
+inline bool operator==(const AttributeIterator& o1, const AttributeIterator& o2) {
+  return o1.attr == o2.attr;
+}
+inline bool operator!=(const AttributeIterator& o1, const AttributeIterator& o2) {
+  return !(o1 == o2);
+}
+
+// The attribute headers of an MFTRecord, for use in range-based for loops. See `MFTRecord::attributeHeaders()`.
+struct AttributeRange {
+  AttributeBase* first; // nullptr if there are no attributes
+  const uint8_t* recordEnd; // End of the used part of the record
+
+  AttributeIterator begin() const { return {first, recordEnd}; }
+  AttributeIterator end() const { return {nullptr, recordEnd}; }
+};
+
 // An entry within the MFT.
 struct MFTRecord {
   char magicNumber[4]; // "FILE" (or, if the entry is unusable, we would find it marked as "BAAD").
@@ -695,7 +977,7 @@ struct MFTRecord {
   uint32_t usedSizeOfMFTEntry;
   uint32_t allocatedSizeOfMFTEntry;
   uint64_t fileReferenceToTheBase_FILE_record; // "MFT entries could be larger than fit into the normal space. In this case, the MFT entry will start in the base MFT record and continued in an extension record." If the file reference to the base file entry is 0x 00 00 00 00 00 00 00 00 then this is a base record. Were it not so, then this field would contain a reference to the base MFT record.
-  uint16_t nextAttributeID; // This is the "next attribute ID" in the sense that it is the next attribute ID to place into this MFTRecord *if* you are adding a new attribute entry I think. Since the attributes are in ascending order by ID apparently. Anyway, main point is that numAttributes() is based on this.       // ntfsdoc-0.6/concepts/attribute_id.html : {"
+  uint16_t nextAttributeID; // This is the "next attribute ID" in the sense that it is the next attribute ID to place into this MFTRecord *if* you are adding a new attribute entry I think. Since the attributes are in ascending order by ID apparently. numAttributes() doesn't use this, since attributes can be removed and leave gaps in the IDs; it walks the attributes up to the end marker instead.       // ntfsdoc-0.6/concepts/attribute_id.html : {"
   // Next Attribute Id
   //     The Attribute Id that will be assigned to the next Attribute added to this MFT Record.
   //     N.B. Incremented each time it is used.
@@ -705,7 +987,11 @@ struct MFTRecord {
   char padding10[2]; // "Align to 4B boundary" on Windows XP
   // [I think this is this but not sure:] The "entry value" or "entry number" for this MFTRecord. This is just the 0-based index of this record basically.
   uint32_t numberOfThisMFTRecord; // On Windows XP
-  char attributesAndFixupValue[0x1000-0x30]; // Attributes and fixup value
+  char attributesAndFixupValue[]; // Attributes and fixup value, up to the end of the record (`NTFS::bytesPerMFTFileRecord()` bytes from the start of it, usually 1024 but 4096 on 4K-sector disks). This struct is only ever a view over a buffer of that size (such as a PooledMFTRecord, or part of the MFT read in bulk), never a copy.
+
+  MFTRecord() = delete;
+  MFTRecord(const MFTRecord& other) = delete; // (It would only copy the header)
+  MFTRecord& operator=(const MFTRecord& other) = delete;
 
   size_t totalSize() const {
     // Wrong size presumably because the fixupArray() is in there too: return offsetof(MFTRecord, attributesAndFixupValue) + sizeOfAllAttributes() + sizeof(0xffffffff /*end of attributes list marker*/);
@@ -724,45 +1010,30 @@ struct MFTRecord {
 
   static const std::vector<const char*> possibleMagicNumbers;
 
-  std::pair<MFTRecord* /*a pointer within the void* buffer*/,
-	    std::pair<unique_free<void*> /*the new buffer for use with `mdr`*/,
-		      ssize_t /*`more` -- what was loaded from disk by this function into (a possibly realloc()'ed) `bufForMDR`*/>>
-  next(const MyDataRuns& mdr, size_t totalAmountLoadedAlready, size_t amountAlreadyLoadedFromMDR, void* bufForMDR /*must be a malloc()'ed buffer*/, size_t* out_seekedAmount,
-		int fd, const NTFS* ntfs) const;
+  // The attribute headers of this record, in order, bounded by `usedSizeOfMFTEntry`. Iterating over them is a single pass that doesn't allocate.
+  AttributeRange attributeHeaders() const {
+    const uint8_t* recordEnd = (const uint8_t*)this + usedSizeOfMFTEntry;
+    if (offsetToFirstAttribute == 0) {
+      return {nullptr, recordEnd};
+    }
+    return {(AttributeBase*)((uint8_t*)this + offsetToFirstAttribute), recordEnd};
+  }
 
   // Returns the sum of all attributes' sizes.
   size_t sizeOfAllAttributes() const {
-    size_t numAttrs = numAttributes();
-    AttributeBase* currentAttr = (AttributeBase*)((uint8_t*)this + offsetToFirstAttribute);
     size_t acc = 0;
-    for (size_t i = 0; i < numAttrs; i++) {
-      acc += currentAttr->attributeLength;
-      currentAttr = (AttributeBase*)((uint8_t*)currentAttr + currentAttr->attributeLength);
+    for (AttributeBase* attr : attributeHeaders()) {
+      acc += attr->attributeLength;
     }
     return acc;
   }
   
   size_t numAttributes() const {
-    size_t retval = nextAttributeID - 1;
-    
-    // Find end marker
     size_t counter = 0;
-    AttributeBase* currentAttr = (AttributeBase*)((uint8_t*)this + offsetToFirstAttribute);
-    while (currentAttr->typeIdentifier != 0xffffffff // The end marker for attribute list
-	     ) {
-      if (!(counter < retval)) {
-	printf("numAttributes: !( counter < retval)\n");
-	break;
-      }
-      
-      currentAttr = (AttributeBase*)((uint8_t*)currentAttr + currentAttr->attributeLength);
+    for (AttributeBase* attr : attributeHeaders()) {
+      (void)attr;
       counter++;
-    };
-
-    printf("numAttributes: counter %ju, retval %ju\n", (uintmax_t)counter, (uintmax_t)retval);
-    //assert(counter == retval);
-    //return retval;
-
+    }
     return counter;
   }
 
@@ -807,30 +1078,20 @@ struct MFTRecord {
       //}
       
       uint16_t* valPtr = (uint16_t*)sectorIterator;
-      printf("applyFixup: %ju should be usn %ju", (uintmax_t)*valPtr, (uintmax_t)usn);
-      fflush(stdout);
+      LOG(LOG_TRACE, "applyFixup: %ju should be usn %ju; %ju -> %ju\n", (uintmax_t)*valPtr, (uintmax_t)usn, (uintmax_t)*valPtr, (uintmax_t)val);
       assert(*valPtr == usn);
-      printf("; %ju -> %ju\n", (uintmax_t)*valPtr, (uintmax_t)val);
       *valPtr = val;
       sectorIterator += bytesPerSector;
     }
   }
 
+  // Like `attributeHeaders()` but collected into a vector of Attributes. Prefer `attributeHeaders()` in loops over many records, since this allocates.
   std::vector<Attribute> attributes() const {
     std::vector<Attribute> ret;
-    AttributeBase* currentAttr = (AttributeBase*)((uint8_t*)this + offsetToFirstAttribute);
-
-    // TODO: what if there are no attributes? this is a failsafe: (maybe return empty array instead but I'm not sure if 0 means this) :
-    assert(offsetToFirstAttribute!=0);
-
-    ret.reserve(numAttributes());
-    for (size_t i = 0; i < numAttributes(); i++) {
-      Attribute attr = makeAttribute(currentAttr);
-      ret.push_back(attr);
-      printf("MFTRecord::attributes: found attribute with type %#jx and offset %#jx from the start of the MFTRecord\n", (uintmax_t)currentAttr->typeIdentifier, (uintmax_t)((uint8_t*)currentAttr - (uint8_t*)this));
-      currentAttr = (AttributeBase*)((uint8_t*)currentAttr + currentAttr->attributeLength);
+    for (AttributeBase* currentAttr : attributeHeaders()) {
+      ret.push_back(makeAttribute(currentAttr));
+      LOG(LOG_TRACE, "MFTRecord::attributes: found attribute with type %#jx and offset %#jx from the start of the MFTRecord\n", (uintmax_t)currentAttr->typeIdentifier, (uintmax_t)((uint8_t*)currentAttr - (uint8_t*)this));
     }
-
     return ret;
   }
 };
@@ -838,7 +1099,83 @@ const std::vector<const char*> MFTRecord::possibleMagicNumbers = {
   "FILE", // File record (the MFTRecord class actually implements this only for now) ( ntfsdoc-0.6/concepts/file_record.html )
   "BAAD", // "Unusable" entry
   "INDX" // Index record ( ntfsdoc-0.6/concepts/index_record.html )
-}; // NOTE: there may be more, add as needed
+}; // NOTE: there may be more, add as needed. (`_checkRecordHeader` tells these apart.)
+
+#pragma pack()
+// An MFTRecord in a buffer of exactly `NTFS::bytesPerMFTFileRecord()` bytes borrowed from a pool (see `Volume::acquireRecord()`), which gets the buffer back when this is destroyed, so reading records one at a time doesn't allocate each time. Move-only.
+class PooledMFTRecord {
+public:
+  PooledMFTRecord() = default;
+
+  explicit PooledMFTRecord(AlignedBufferPool* pool_): pool(pool_), rec((MFTRecord*)pool_->acquire()) {}
+
+  PooledMFTRecord(PooledMFTRecord&& other) noexcept: pool(other.pool), rec(other.rec) {
+    other.rec = nullptr;
+  }
+
+  PooledMFTRecord& operator=(PooledMFTRecord&& other) noexcept {
+    if (this != &other) {
+      release();
+      pool = other.pool;
+      rec = other.rec;
+      other.rec = nullptr;
+    }
+    return *this;
+  }
+
+  PooledMFTRecord(const PooledMFTRecord& other) = delete;
+
+  ~PooledMFTRecord() {
+    release();
+  }
+
+  MFTRecord* get() const { return rec; }
+  MFTRecord* operator->() const { return rec; }
+  MFTRecord& operator*() const { return *rec; }
+
+  // Size of the buffer in bytes, i.e. of the record
+  size_t size() const { return rec == nullptr ? 0 : pool->bufferSize; }
+
+protected:
+  AlignedBufferPool* pool = nullptr;
+  MFTRecord* rec = nullptr;
+
+  void release() {
+    if (rec != nullptr) {
+      pool->release(rec);
+      rec = nullptr;
+    }
+  }
+};
+
+// What `_checkRecordHeader` and `_checkRecordAttributes` make of a record
+enum RecordCheck : uint8_t {
+  RECORD_OK,
+  RECORD_EMPTY, // Never written (no magic number) or not in use: nothing to parse, but nothing wrong either
+  RECORD_BAAD, // Marked unusable ("BAAD"), e.g. by chkdsk after a failed multi-sector transfer
+  RECORD_BAD_MAGIC, // Not a file record: an "INDX" record where one should be, or garbage
+  RECORD_BAD_HEADER, // The update sequence array, the first attribute or the used or allocated size is out of bounds
+  RECORD_BAD_ATTRIBUTES, // An attribute's length is zero, unaligned or past the used size, its name, content or runlist doesn't fit in it (see `RunList::isValid`), or the end marker is missing
+  RECORD_TORN, // Failed its fixup check (see `_applyFixups`)
+  RECORD_OUT_OF_RANGE, // Past the end of the MFT (see `Volume::getRecord`)
+  RECORD_MFT_INCOMPLETE // In the MFT, but past the runs in its first record: the rest are in extension records that its $ATTRIBUTE_LIST points to, which aren't followed (see `Volume::mftDataRuns`)
+};
+
+inline const char* recordCheckName(RecordCheck check) {
+  switch (check) {
+  case RECORD_OK: return "ok";
+  case RECORD_EMPTY: return "empty";
+  case RECORD_BAAD: return "marked BAAD";
+  case RECORD_BAD_MAGIC: return "bad magic number";
+  case RECORD_BAD_HEADER: return "bad header";
+  case RECORD_BAD_ATTRIBUTES: return "bad attributes";
+  case RECORD_TORN: return "torn";
+  case RECORD_OUT_OF_RANGE: return "past the end of the MFT";
+  case RECORD_MFT_INCOMPLETE: return "in a part of the MFT whose runs are in an extension record (not supported)";
+  default: return "?";
+  }
+}
+#pragma pack(1)
 
 
 enum MediaDescriptor: uint8_t {
@@ -895,13 +1232,10 @@ struct NTFS {
     return mftOffset * bytesPerCluster();
   }
 
-  // Reads in sizeof(MFTRecord) bytes from `fd` at the MFT starting location specified by this NTFS struct.
-  MFTRecord getFirstMFTRecord(int fd) const {
-    off_t offset = mftOffsetInBytes();
-    _lseek(fd, offset, SEEK_SET);
-    MFTRecord buf;
-    _read(fd, &buf, sizeof(MFTRecord));
-    return buf;
+
+  // Whether this looks like an NTFS boot sector at all (as opposed to e.g. an MBR or another file system)
+  bool hasNTFSSystemID() const {
+    return memcmp(systemID, "NTFS    ", sizeof(systemID)) == 0;
   }
 };
 static_assert(offsetof(NTFS, numberOfHeads) == 0x1A);
@@ -909,241 +1243,1305 @@ static_assert(offsetof(NTFS, totalSectors) == 0x28);
 static_assert(offsetof(NTFS, mftMirrOffset) == 0x0038);
 static_assert(offsetof(NTFS, notUsed50) == 0x50);
 
-std::pair<MFTRecord* /*a pointer within the void* buffer*/,
-	  std::pair<unique_free<void*> /*the new buffer for use with `mdr`*/,
-		    ssize_t /*`more` -- what was loaded from disk by this function into (a possibly realloc()'ed) `bufForMDR`*/>>
-MFTRecord::next(const MyDataRuns& mdr, size_t totalAmountLoadedAlready, size_t amountAlreadyLoadedFromMDR, void* bufForMDR /*must be a malloc()'ed buffer*/, size_t* out_seekedAmount,
-     int fd, const NTFS* ntfs) const {
-  // Read in a single MFTRecord by reading the number of clusters per MFT record.
-  // FIXME: handle INDX for index records aka "index buffers" -- see NTFS struct and search for these terms for more info.
-  bool moreNeeded; ssize_t more;
-  printf("MFTRecord::next: calling mdr.load to get %ju more bytes\n", (uintmax_t)ntfs->bytesPerMFTFileRecord());
-  auto ret = mdr.load(totalAmountLoadedAlready, bufForMDR, ntfs->bytesPerMFTFileRecord(), fd, ntfs, &moreNeeded, &more);
-  bufForMDR = ret.get();
-  printf("MFTRecord::next: mdr.load set moreNeeded to %s and more to %jd\n", moreNeeded == true ? "true" : "false", (intmax_t)more);
-  *out_seekedAmount = ntfs->bytesPerMFTFileRecord();
-  return std::make_pair((MFTRecord*)((uint8_t*)bufForMDR + amountAlreadyLoadedFromMDR + ntfs->bytesPerMFTFileRecord()), std::make_pair(std::move(ret), more));
-}
+#pragma pack()
+// Non-NTFS-specific struct
+struct VolumeOptions {
+  bool directIO = false; // Open with O_DIRECT so that reads bypass the page cache and scanning a live device doesn't evict everything else on the host. O_DIRECT needs aligned reads, so reads then go through `readAllDirect` (see directIO.hpp) using `Volume::directIOBufferPool`. Memory-mapping is skipped in this mode since it would go through the page cache.
+  bool mmap = true; // Memory-map the volume if it is in a regular file (an image such as partition.dd), so that structures can be viewed in place instead of being copied into buffers and the page cache does readahead for us. Block devices always use reads.
+  size_t blockCacheBudget = 64 * 1024 * 1024; // Memory budget in bytes of the cluster cache (see `Volume::readAll`). 0 disables it.
+};
 
-// Makes and loads a contiguous buffer from the dataRuns' specified offsets and lengths by dynamically allocating enough memory to hold it, then returning it. The buffer may be incomplete, i.e. if the amount available in `dataRuns` was less than `amountToLoad`. If so, `out_moreNeeded` will be set to true by this function.
-// `bool out_moreNeeded` will be set to true if the `dataRuns` ran out before `amountToLoad` was reached; otherwise, it will be set to false.
-// `out_more` will be set to a positive number indicating how much more was left to be loaded *if* `amountToLoad` was less than the total length of `dataRuns`. It will be set to a negative number if `amountToLoad` is greater than the total length of `dataRuns`. It will be set to zero otherwise.
-// Returns a unique_ptr containing nullptr if `dataRuns.size() == 0`. If you provided the buffer, you may want to use .release() on the unique_ptr to take back ownership of the memory.
-unique_free<void*> MyDataRuns::load(size_t bufOffset /*seek into the data runs by this amount before loading. Set to 0 for the first load. This number must be a multiple of `ntfs->bytesPerCluster()`.*/,
-				    void* buf /*optional existing buffer. Set to nullptr to allocate a new one. If provided (non-null), this function will place more data only starting at buf + `bufOffset` provided.*/,
-				    size_t amountToLoad,
-				    int fd, const NTFS* ntfs, bool* out_moreNeeded, ssize_t* out_more) const {
-  assert(bufOffset % ntfs->bytesPerCluster() == 0);
-  
-  _lseek(fd, 0, SEEK_SET); // Go to the start so we can use SEEK_CUR (to do a relative seek) later.
-  
-  size_t totalLength = 0;
-  bool completeStruct = false;
-  //void* buf = nullptr;
-  // Assumptions (for now) //
-  *out_more = 0;
-  *out_moreNeeded = false;
-  // //
-  
-  // NOTE: this is not checked because it is outside the scope/concerns of this function. This needs to be checked when using LazilyLoaded::loadUpTo().
-  // if (dataRuns.hasMore) {
-  //   *out_moreNeeded = true;
-  // }
-  
-  for (MyDataRun dr /*copy so we can modify it without affecting the original*/ : dataRuns) {
-    printf("MyDataRuns::load: processing: dr.offset = %ju, length = %ju\n", (uintmax_t)dr.offset, (uintmax_t)dr.length);
-    if (dr.length == 0) {
-      // completeStruct = true;
-      // break;
+// An open NTFS volume: owns the file or device it is in, where the volume starts within it, its boot sector, and the state used to read from it (memory mapping, O_DIRECT buffers and cluster cache). Volumes don't share anything but the read engine (see `_readEngine`), so many can be open in one process, and all of the reading functions are safe to call from multiple threads at once.
+struct Volume {
+  int fd;
+  unsigned long long seekBase; // Offset in bytes of the start of the volume within `fd`. All `offset`s given to this struct's functions are from the start of the volume.
+  bool directIO;
+  size_t directIOAlignment = 0;
+  std::unique_ptr<AlignedBufferPool> directIOBufferPool; // nullptr unless `directIO`
+  std::unique_ptr<BlockCache> blockCache; // Recently read clusters keyed by LCN. nullptr if disabled.
+  std::unique_ptr<AlignedBufferPool> recordBufferPool; // Buffers of exactly one MFT record (see `acquireRecord`)
+  // The memory-mapped file (see `VolumeOptions::mmap`). The mapping is private (copy-on-write), so in-place changes such as MFTRecord::applyFixup() never reach the file but are seen by every view of the same bytes. Reads are unaffected and always return the bytes in the file.
+  uint8_t* mapping = nullptr;
+  size_t mappingSize = 0;
+  off_t fileSize = 0; // Size of the file if it is a regular file, or 0 for block devices
+
+  Volume(const char* path, unsigned long long seekBase_ = 0, const VolumeOptions& options = VolumeOptions()): seekBase(seekBase_), directIO(options.directIO) {
+    fd = _open(path, O_RDONLY | (directIO ? O_DIRECT : 0));
+    IOPhaseScope phase(IO_PHASE_BOOT_SECTOR);
+    try {
+      struct stat st;
+      if (fstat(fd, &st) == -1) {
+	perror("fstat failed");
+	throw errno;
+      }
+      if (S_ISREG(st.st_mode)) {
+	fileSize = st.st_size;
+      }
+      size_t requiredAlignment = 0;
+      if (directIO) {
+	requiredAlignment = directIOAlignmentOf(fd); // The logical block size of the device, or what the file system an image is on needs
+	setDirectIOAlignment(std::max((size_t)4096, requiredAlignment)); // Safe for any sector size until we know the real one
+      }
+      else if (options.mmap) {
+	mapFile();
+      }
 
-      printf("MyDataRuns::load: dr.length == 0\n");
-      continue;
-    }
-    
-    size_t lengthToLoad = dr.length * ntfs->bytesPerCluster();
-    printf("MyDataRuns::load: lengthToLoad: %zu bytes\n", lengthToLoad);
-    
-    // Seek further if needed
-    if (totalLength + lengthToLoad >= bufOffset) { // TODO: untested
-      // We seeked enough and are in the run we left off in "last time"
-      // So now we need to load in the rest of this run
-      size_t newOffsetBytes = dr.offset * ntfs->bytesPerCluster() + (bufOffset - totalLength);
-      printf("MyDataRuns::load: seeked past enough runs. Now seeking within data run to get to bufOffset. Now at %ju bytes, was at %ju\n", (uintmax_t)(newOffsetBytes), (uintmax_t)(dr.offset * ntfs->bytesPerCluster()));
-      lengthToLoad = lengthToLoad - (newOffsetBytes - dr.offset * ntfs->bytesPerCluster());
-      dr.offset = newOffsetBytes / ntfs->bytesPerCluster();
-      printf("MyDataRuns::load: lengthToLoad: adjusted to %zu bytes\n", lengthToLoad);
-    }
-    else { // TODO: untested
-      // We need to seek more (to the next run)
-      totalLength += lengthToLoad;
-      printf("MyDataRuns::load: seeking to the next data run to try to get past bufOffset (%ju). Now at %ju bytes\n", (uintmax_t)bufOffset, (uintmax_t)totalLength);
-      continue;
-    }
-    
-    if (totalLength + lengthToLoad > amountToLoad) { // TODO: untested
-      // Limit length of what we load
-      lengthToLoad = amountToLoad - totalLength;
-      printf("MyDataRuns::load: limiting length to %zu bytes\n", lengthToLoad);
-      completeStruct = true;
-      *out_more = lengthToLoad;
-    }
-    printf("MyDataRuns::load: calling realloc(%p, %zu) aka %f MiB\n", buf, totalLength+lengthToLoad, (float)(totalLength+lengthToLoad) / 1024 / 1024);
-    buf = realloc(buf, totalLength+lengthToLoad);
-    _lseek(fd, dr.offset * ntfs->bytesPerCluster(), SEEK_CUR); // Seek relative to the last seek
-    _read(fd, (uint8_t*)buf+totalLength /*load into the position after where we wrote into `buf` last iteration*/ + bufOffset, lengthToLoad);
-    _lseek(fd, -lengthToLoad, SEEK_CUR); // Seek back to the start of the run (since the fd's file offset was changed after the read())
-    totalLength += lengthToLoad;
-    if (totalLength >= amountToLoad || completeStruct) {
-      // Done loading
-      completeStruct = true;
-      if (totalLength > amountToLoad) { // TODO: untested
-	*out_more = amountToLoad - totalLength; // (Negative)
+      bootSector = (NTFS*)view(sizeof(NTFS), 0);
+      if (bootSector == nullptr) {
+	pread(&bootSectorCopy, sizeof(NTFS), 0);
+	bootSector = &bootSectorCopy;
       }
-      break;
+      if (!ntfs().hasNTFSSystemID() || ntfs().bytesPerCluster() == 0) {
+	fprintf(stderr, "%s at offset %llu doesn't look like an NTFS volume\n", path, seekBase);
+	throw UnhandledValue();
+      }
+
+      if (directIO) {
+	setDirectIOAlignment(std::max((size_t)ntfs().bytesPerSector, requiredAlignment));
+      }
+      size_t recordSize = ntfs().bytesPerMFTFileRecord();
+      if (recordSize < sizeof(MFTRecord) || recordSize > 65536 || recordSize % ntfs().bytesPerSector != 0) {
+	fprintf(stderr, "%s at offset %llu has an unsupported MFT record size of %zu bytes\n", path, seekBase, recordSize);
+	throw UnhandledValue();
+      }
+      recordBufferPool.reset(new AlignedBufferPool(std::min(recordSize & -recordSize, (size_t)4096), recordSize)); // (Aligned to the largest power of two that divides the record size, up to a page)
+      if (options.blockCacheBudget > 0) {
+	blockCache.reset(new BlockCache(ntfs().bytesPerCluster(), options.blockCacheBudget));
+      }
+    }
+    catch (...) {
+      unmapAndClose();
+      throw;
     }
   }
 
-  if (!completeStruct) { // Then `amountToLoad` was too large for the runs' contents, or the runs ran out because not enough was loaded.
-    *out_moreNeeded = true; // TODO: untested
+  Volume(const Volume& other) = delete;
+
+  ~Volume() {
+    unmapAndClose();
   }
 
-  return unique_free<void*>((void**)buf);
-}
+  // The boot sector ($Boot), either viewed in place in the memory-mapped file or a copy of it.
+  NTFS& ntfs() const { return *bootSector; }
 
-Pair<AttributeContentWithFreer, std::optional<MyDataRuns>> NonResidentAttribute::content(size_t limitToLoad, bool* out_moreNeeded, ssize_t* out_more, int fd, const NTFS* ntfs) const {
-  // Load all the content virtually (since we can't load it all because it might be massive amounts of data)
-  // Grab the runlist
-  RunList* firstRunListEntry = (RunList*)((uint8_t*)this + offsetToTheRunList);
-  // Grab its data runs
-  size_t attrActualSize = 0; // 0 if unknown
-  switch (base.typeIdentifier) {
-  case STANDARD_INFORMATION:
-    attrActualSize = sizeof(StandardInformation);
-    break;
-  case FILE_NAME:
-    attrActualSize = sizeof(FileName);
-    break;
-  case DATA:
-    break;
-  case VOLUME_INFORMATION:
-    attrActualSize = sizeof(VolumeInformation); // "As defined in $AttrDef, this attribute has a minimum and a maximum size of 12 bytes." ( ntfsdoc-0.6/attributes/volume_information.html )
-    break;
-  default:
-    throw UnhandledValue();
-  }
+  bool isMapped() const { return mapping != nullptr; }
 
-  if (attrActualSize != 0) {
-    if (attrActualSize > limitToLoad) {
-      printf("NonResidentAttribute::content: warning: attrActualSize > limitToLoad. attrActualSize = %ju, limitToLoad = %ju. This means the whole structure won't be loaded in.\n", (uintmax_t)attrActualSize, (uintmax_t)limitToLoad);
+  // Reads exactly `count` bytes at `offset`. This is a single positional read (unless it is served from the cluster cache), so it doesn't use or change the fd's shared file offset.
+  ssize_t pread(void* buf, size_t count, off_t offset) const {
+    if (directIO || blockCache != nullptr) {
+      readAll({{buf, count, offset}});
+    }
+    else {
+      preadFully(fd, buf, count, seekBase + offset);
+    }
+    return count;
+  }
+
+  // Reads all of `requests` (whose offsets are from the start of the volume) at once, serving whole clusters from `blockCache` where possible and caching the clusters that had to be read. Requests larger than an eighth of the cache bypass it so that bulk loads don't flush it. Passes that read everything once, such as MFTScanner, pass `useCache` = false so that their reads (which can be small, between records the MFT's $BITMAP skips) bypass it too instead of pushing out the clusters it is there to keep.
+  void readAll(const std::vector<ReadRequest>& requests, bool useCache = true) const {
+    std::vector<ReadRequest> fileRequests;
+    if (blockCache == nullptr || !useCache) {
+      for (const ReadRequest& r : requests) {
+	fileRequests.push_back({r.buf, r.length, (off_t)(seekBase + r.offset)});
+      }
+      _readAll(fd, fileRequests, directIOBufferPool.get(), fileSize);
+      return;
+    }
+
+    BlockCache& cache = *blockCache;
+    const size_t clusterSize = cache.blockSize;
+    const size_t bypassSize = cache.capacityInBytes() / 8;
+    // Copies the part of cluster `lcn` (whose bytes are at `src`) that `r` wants into `r.buf`.
+    auto copyOut = [clusterSize](const ReadRequest& r, size_t lcn, const uint8_t* src) {
+      off_t clusterStart = lcn * clusterSize;
+      off_t from = std::max(clusterStart, r.offset), to = std::min(clusterStart + (off_t)clusterSize, r.offset + (off_t)r.length);
+      memcpy((uint8_t*)r.buf + (from - r.offset), src + (from - clusterStart), to - from);
+    };
+
+    // Consecutive clusters of one request that weren't in the cache
+    struct Miss {
+      size_t requestIndex;
+      size_t firstLCN;
+      size_t clusterCount;
+      std::unique_ptr<uint8_t[]> buf;
+    };
+    std::vector<Miss> misses;
+    for (size_t i = 0; i < requests.size(); i++) {
+      const ReadRequest& r = requests[i];
+      if (r.length == 0) {
+	continue;
+      }
+      if (r.length > bypassSize) {
+	fileRequests.push_back({r.buf, r.length, (off_t)(seekBase + r.offset)});
+	continue;
+      }
+      size_t firstLCN = r.offset / clusterSize, endLCN = integerDivisionRoundingUp(r.offset + r.length, clusterSize);
+      for (size_t lcn = firstLCN; lcn < endLCN; lcn++) {
+	off_t clusterStart = lcn * clusterSize;
+	off_t from = std::max(clusterStart, r.offset), to = std::min(clusterStart + (off_t)clusterSize, r.offset + (off_t)r.length);
+	if (cache.lookup(lcn, (uint8_t*)r.buf + (from - r.offset), from - clusterStart, to - from)) {
+	  continue;
+	}
+	if (!misses.empty() && misses.back().requestIndex == i && misses.back().firstLCN + misses.back().clusterCount == lcn) {
+	  misses.back().clusterCount++;
+	}
+	else {
+	  misses.push_back({i, lcn, 1, nullptr});
+	}
+      }
+    }
+
+    for (Miss& m : misses) {
+      m.buf.reset(new uint8_t[m.clusterCount * clusterSize]);
+      fileRequests.push_back({m.buf.get(), m.clusterCount * clusterSize, (off_t)(seekBase + m.firstLCN * clusterSize)});
+    }
+    _readAll(fd, fileRequests, directIOBufferPool.get(), fileSize);
+    for (Miss& m : misses) {
+      for (size_t c = 0; c < m.clusterCount; c++) {
+	const uint8_t* src = m.buf.get() + c * clusterSize;
+	cache.insert(m.firstLCN + c, src);
+	copyOut(requests[m.requestIndex], m.firstLCN + c, src);
+      }
+    }
+  }
+
+  // Returns a pointer to `count` bytes at `offset` within the memory-mapped file, or nullptr if it isn't mapped or the range is outside it. Use `pread` if this returns nullptr.
+  void* view(size_t count, off_t offset) const {
+    if (mapping == nullptr) {
+      return nullptr;
+    }
+    size_t start = seekBase + offset;
+    if (start > mappingSize || count > mappingSize - start) {
+      return nullptr;
+    }
+    ioStats().recordMapped(count);
+    return mapping + start;
+  }
+
+  // Asks the kernel to start reading `count` bytes at `offset` in the background: `madvise` for the memory-mapped file, otherwise `posix_fadvise`, which starts readahead into the page cache. (This does nothing in O_DIRECT mode, since the page cache isn't used then.)
+  void prefetch(size_t count, off_t offset) const {
+    if (count == 0) {
+      return;
+    }
+    if (mapping != nullptr) {
+      size_t pageSize = sysconf(_SC_PAGESIZE);
+      size_t start = std::min((size_t)(seekBase + offset), mappingSize), end = std::min(start + count, mappingSize);
+      size_t alignedStart = start / pageSize * pageSize;
+      if (end > alignedStart) {
+	madvise(mapping + alignedStart, end - alignedStart, MADV_WILLNEED); // (Just a hint, so failure is ignored)
+      }
+    }
+    else if (!directIO) {
+      posix_fadvise(fd, seekBase + offset, count, POSIX_FADV_WILLNEED); // (Just a hint, so failure is ignored)
+    }
+  }
+
+  // Returns an uninitialized record-sized buffer from `recordBufferPool`.
+  PooledMFTRecord acquireRecord() const {
+    return PooledMFTRecord(recordBufferPool.get());
+  }
+
+  // Reads in one record (`NTFS::bytesPerMFTFileRecord()` bytes) at the MFT starting location specified by the boot sector.
+  PooledMFTRecord getFirstMFTRecord() const {
+    IOPhaseScope phase(IO_PHASE_MFT_LOAD);
+    PooledMFTRecord rec = acquireRecord();
+    pread(rec.get(), rec.size(), ntfs().mftOffsetInBytes());
+    return rec;
+  }
+
+  // Record 0 of the MFT ($MFT itself), read with `getRecord(0)` (so checked and fixed up) the first time and kept for `mftDataRuns` and `mftBitmap`. Throws if it fails the checks, since nothing else can be found without it. Safe to call from any thread.
+  const MFTRecord& mftRecord() const;
+
+  // Like `mftDataRuns` but only loads the runs the first time, keeping them for `getRecord` and `recordOffset`. Safe to call from any thread.
+  const MyDataRuns& mftRuns(uint64_t* out_sizeInBytes = nullptr) const {
+    std::call_once(mftRunsLoaded, [this]() {
+      mftRunsCache = mftDataRuns(&mftSizeCache);
+    });
+    if (out_sizeInBytes != nullptr) {
+      *out_sizeInBytes = mftSizeCache;
+    }
+    return mftRunsCache;
+  }
+
+  // Sets `out_offset` to where record `recordNumber` of the MFT starts, in bytes from the start of the volume, by looking it up in the MFT's runs. Returns false if the MFT doesn't have that many records, or if the record is past the runs in its first record (see `mftDataRuns`).
+  bool recordOffset(uint64_t recordNumber, off_t* out_offset) const {
+    uint64_t mftSize;
+    const MyDataRuns& runs = mftRuns(&mftSize);
+    const size_t recordSize = ntfs().bytesPerMFTFileRecord(), bytesPerCluster = ntfs().bytesPerCluster();
+    int64_t lcn;
+    if (recordNumber >= mftSize / recordSize || !runs.lcnOf(recordNumber * recordSize / bytesPerCluster, &lcn)) {
+      return false;
+    }
+    *out_offset = lcn * bytesPerCluster + recordNumber * recordSize % bytesPerCluster;
+    return true;
+  }
+
+  // Reads record `recordNumber` of the MFT (e.g. 3 for $Volume, or the low 48 bits of a file reference) straight from where the MFT's runs put it, which is a single read of exactly one record (two if it straddles runs), instead of walking to it from the start of the MFT. Returns it checked and fixed up, or an empty PooledMFTRecord if it is past the end of the MFT or fails the checks, with `out_check` (if given) set to why. Defined after the record checks it uses.
+  PooledMFTRecord getRecord(uint64_t recordNumber, RecordCheck* out_check = nullptr) const;
+
+  // The runs of the MFT, in the unnamed $DATA attribute of its first record ($MFT itself), still encoded, for streaming through them with `LazilyLoaded::loadUpTo` and `MyDataRuns::dropBefore` (as `MFTScanner::scan` does) rather than decoding them all at once like `mftDataRuns`. `out_sizeInBytes` (if given) is set to the size of the MFT. Throws if that attribute is missing. The result points into `mftRecord()`, so it stays valid as long as this Volume.
+  LazilyLoaded mftRunList(uint64_t* out_sizeInBytes = nullptr) const {
+    for (AttributeBase* attr : mftRecord().attributeHeaders()) {
+      if (attr->typeIdentifier == DATA && attr->nonResidentFlag == 1 && attr->lengthOfName == 0) {
+	NonResidentAttribute* nonResident = (NonResidentAttribute*)attr;
+	if (nonResident->startingVirtualClusterNumberOfTheDataRuns != 0) {
+	  fprintf(stderr, "Volume::mftRunList: the $DATA attribute in the first MFT record starts at VCN %ju instead of 0\n", (uintmax_t)nonResident->startingVirtualClusterNumberOfTheDataRuns);
+	  throw UnhandledValue();
+	}
+	if (out_sizeInBytes != nullptr) {
+	  *out_sizeInBytes = nonResident->actualSizeOfTheAttributeContent;
+	}
+	return LazilyLoaded{(RunList*)((uint8_t*)nonResident + nonResident->offsetToTheRunList), (uint8_t*)nonResident + attr->attributeLength};
+      }
+    }
+    fprintf(stderr, "Volume::mftRunList: no non-resident $DATA attribute in the first MFT record\n");
+    throw UnhandledValue();
+  }
+
+  // Returns all of the runs of the MFT (see `mftRunList`), without reading any of the MFT past its first record. `out_sizeInBytes` is set to the size of the MFT. On a very fragmented MFT the runs don't all fit in that record and the rest are in extension records listed by its $ATTRIBUTE_LIST; those aren't followed, so the runs returned stop short of the size of the MFT and the records past them can't be read (`getRecord` says RECORD_MFT_INCOMPLETE for them).
+  MyDataRuns mftDataRuns(uint64_t* out_sizeInBytes) const {
+    IOPhaseScope phase(IO_PHASE_MFT_LOAD);
+    MyDataRuns ret = mftRunList(out_sizeInBytes).loadUpTo(SIZE_MAX);
+    const size_t recordSize = ntfs().bytesPerMFTFileRecord();
+    uint64_t recordsInRuns = ret.endVCN() * ntfs().bytesPerCluster() / recordSize;
+    if (recordsInRuns < *out_sizeInBytes / recordSize) {
+      bool hasAttributeList = false;
+      for (AttributeBase* attr : mftRecord().attributeHeaders()) {
+	hasAttributeList = hasAttributeList || attr->typeIdentifier == ATTRIBUTE_LIST;
+      }
+      LOG(LOG_ERROR, "Volume::mftDataRuns: the runs in the first MFT record only cover %ju of the MFT's %ju records%s. Extension records of $MFT aren't supported, so the rest can't be read.\n", (uintmax_t)recordsInRuns, (uintmax_t)(*out_sizeInBytes / recordSize), hasAttributeList ? " (the rest are in the extension records listed by its $ATTRIBUTE_LIST)" : "");
+    }
+    return ret;
+  }
+
+  // Returns the MFT's $BITMAP attribute (bit n is set if record n is in use), reading it from disk if it is non-resident, as it is on all but tiny volumes. Returns an empty vector if the first MFT record has no usable one.
+  std::vector<uint8_t> mftBitmap() const {
+    IOPhaseScope phase(IO_PHASE_MFT_LOAD);
+    std::vector<uint8_t> ret;
+    for (AttributeBase* attr : mftRecord().attributeHeaders()) {
+      if (attr->typeIdentifier != BITMAP || attr->lengthOfName != 0) {
+	continue;
+      }
+      if (attr->nonResidentFlag == 0) {
+	ResidentAttribute* resident = (ResidentAttribute*)attr;
+	uint8_t* content = resident->boundedContent();
+	if (content != nullptr) {
+	  ret.assign(content, content + resident->sizeOfContent);
+	}
+      }
+      else {
+	NonResidentAttribute* nonResident = (NonResidentAttribute*)attr;
+	MyDataRuns runs = LazilyLoaded{(RunList*)((uint8_t*)nonResident + nonResident->offsetToTheRunList), (uint8_t*)nonResident + attr->attributeLength}.loadUpTo(SIZE_MAX);
+	ret.resize(nonResident->actualSizeOfTheAttributeContent);
+	ret.resize(runs.readInto(ret.data(), 0, ret.size(), *this)); // (Shorter if the runs ran out)
+      }
+      break;
+    }
+    return ret;
+  }
+
+protected:
+  NTFS* bootSector;
+  NTFS bootSectorCopy; // Used if the boot sector can't be viewed in place
+  mutable std::once_flag mftRecordLoaded;
+  mutable PooledMFTRecord mftRecordCache; // See `mftRecord`
+  mutable std::once_flag mftRunsLoaded;
+  mutable MyDataRuns mftRunsCache; // See `mftRuns`
+  mutable uint64_t mftSizeCache = 0;
+
+  // Maps `fd` if it is a regular file. Leaves `mapping` as nullptr for block devices or if the mapping fails.
+  void mapFile() {
+    if (fileSize == 0) {
+      return;
+    }
+    // MAP_NORESERVE since the mapping is writable: without it the whole file would count against the commit limit as private memory, so images larger than RAM plus swap couldn't be mapped. Only the few pages that are written to (see `mapping`) ever get copied.
+    void* base = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, 0);
+    if (base == MAP_FAILED) {
+      LOG(LOG_WARN, "Volume::mapFile: mmap of %jd bytes failed: %s. Falling back to pread.\n", (intmax_t)fileSize, strerror(errno));
+      return;
+    }
+    mapping = (uint8_t*)base;
+    mappingSize = fileSize;
+  }
+
+  void setDirectIOAlignment(size_t alignment) {
+    directIOAlignment = alignment;
+    size_t bufferSize = integerDivisionRoundingUp((size_t)1024*1024, alignment) * alignment;
+    directIOBufferPool.reset(new AlignedBufferPool(alignment, bufferSize));
+  }
+
+  void unmapAndClose() {
+    if (mapping != nullptr) {
+      if (munmap(mapping, mappingSize) == -1) {
+	perror("munmap failed");
+      }
+      mapping = nullptr;
+    }
+    if (fd != -1) {
+      ioStats().forgetFd(fd);
+      if (close(fd) == -1) {
+	perror("close failed");
+      }
+      fd = -1;
+    }
+  }
+};
+
+// Returns where the NTFS volumes in the file or device at `path` are: just one at offset 0 if it is a volume itself (e.g. /dev/sda4 or partition.dd), otherwise every partition in its MBR or GPT partition table that has an NTFS boot sector (e.g. /dev/sda or an image of a whole disk). `Partition::number` is 0 in the first case.
+std::vector<Partition> _findNTFSVolumes(const char* path) {
+  int fd = _open(path, O_RDONLY);
+  std::vector<Partition> ret;
+  IOPhaseScope phase(IO_PHASE_PARTITION_TABLE);
+  try {
+    NTFS bootSector;
+    preadFully(fd, &bootSector, sizeof(bootSector), 0);
+    if (bootSector.hasNTFSSystemID()) {
+      ret.push_back({0, "none", 0, bootSector.totalSectors * bootSector.bytesPerSector});
+    }
+    else {
+      for (const Partition& p : readPartitionTable(fd)) {
+	preadFully(fd, &bootSector, sizeof(bootSector), p.offset);
+	if (bootSector.hasNTFSSystemID()) {
+	  ret.push_back(p);
+	}
+	else {
+	  LOG(LOG_INFO, "Skipping %s partition %u at offset %llu since it isn't NTFS\n", p.scheme, p.number, p.offset);
+	}
+      }
+    }
+  }
+  catch (...) {
+    _close(fd);
+    throw;
+  }
+  _close(fd);
+  return ret;
+}
+#pragma pack(1)
+
+size_t MyDataRuns::findRun(uint64_t vcn) const {
+  // The last run starting at or before `vcn`
+  auto it = std::upper_bound(index.begin(), index.end(), vcn, [](uint64_t vcn, const MyRunExtent& e){ return vcn < e.vcn; });
+  if (it == index.begin()) {
+    return index.size();
+  }
+  --it;
+  if (vcn >= it->vcn + it->length) {
+    return index.size();
+  }
+  return it - index.begin();
+}
+
+bool MyDataRuns::lcnOf(uint64_t vcn, int64_t* out_lcn) const {
+  size_t i = findRun(vcn);
+  if (i == index.size()) {
+    return false;
+  }
+  *out_lcn = index[i].lcn + (vcn - index[i].vcn);
+  return true;
+}
+
+std::vector<MyExtent> MyDataRuns::plan(size_t bufOffset, size_t amountToLoad, const Volume& volume, size_t* out_endOfRuns, size_t maxExtents) const {
+  const size_t bytesPerCluster = volume.ntfs().bytesPerCluster();
+  std::vector<MyExtent> extents;
+  const size_t wantedEnd = amountToLoad > SIZE_MAX - bufOffset ? SIZE_MAX : bufOffset + amountToLoad;
+  *out_endOfRuns = endVCN() * bytesPerCluster;
+  for (size_t i = findRun(bufOffset / bytesPerCluster); i < index.size() && extents.size() < maxExtents; i++) {
+    const MyRunExtent& e = index[i];
+    size_t runStart = e.vcn * bytesPerCluster, runEnd = runStart + e.length * bytesPerCluster; // Offsets in bytes of the run within the data
+    if (runStart >= wantedEnd) {
+      break;
+    }
+    LOG(LOG_TRACE, "MyDataRuns::plan: run %zu: VCN %ju, LCN %jd, length = %ju\n", i, (uintmax_t)e.vcn, (intmax_t)e.lcn, (uintmax_t)e.length);
+
+    // Load the part of this run that overlaps [bufOffset, bufOffset + amountToLoad)
+    size_t from = std::max(runStart, bufOffset), to = std::min(runEnd, wantedEnd);
+    if (from < to) {
+      if (e.sparse) {
+	extents.push_back({0, from, to - from, true}); // Nothing on disk
+      }
+      else {
+	extents.push_back({(off_t)(e.lcn * bytesPerCluster + (from - runStart)), from, to - from});
+      }
     }
-    limitToLoad = std::min(limitToLoad, attrActualSize);
   }
-  MyDataRuns dr = LazilyLoaded{firstRunListEntry}.loadUpTo(limitToLoad);
+  return extents;
+}
+
+// Makes and loads a contiguous buffer from the dataRuns' specified offsets and lengths by dynamically allocating enough memory to hold it, then returning it. The buffer may be incomplete, i.e. if the amount available in `dataRuns` was less than `amountToLoad`. If so, `out_moreNeeded` will be set to true by this function.
+// `bool out_moreNeeded` will be set to true if the `dataRuns` ran out before `amountToLoad` was reached; otherwise, it will be set to false.
+// `out_more` will be set to a positive number indicating how much more was left to be loaded *if* `amountToLoad` was less than the total length of `dataRuns`. It will be set to a negative number if `amountToLoad` is greater than the total length of `dataRuns`. It will be set to zero otherwise.
+// Returns a unique_ptr containing nullptr if `dataRuns.size() == 0`. If you provided the buffer, you may want to use .release() on the unique_ptr to take back ownership of the memory.
+unique_free<void*> MyDataRuns::load(size_t bufOffset /*seek into the data runs by this amount before loading. Set to 0 for the first load. This number must be a multiple of `volume.ntfs().bytesPerCluster()`.*/,
+				    void* buf /*optional existing buffer. Set to nullptr to allocate a new one. If provided (non-null), this function will place more data only starting at buf + `bufOffset` provided.*/,
+				    size_t amountToLoad,
+				    const Volume& volume, bool* out_moreNeeded, ssize_t* out_more) const {
+  assert(bufOffset % volume.ntfs().bytesPerCluster() == 0);
+
+  // NOTE: this is not checked because it is outside the scope/concerns of this function. This needs to be checked when using LazilyLoaded::loadUpTo().
+  // if (dataRuns.hasMore) {
+  //   *out_moreNeeded = true;
+  // }
+
+  // Plan the reads first so that `buf` only needs to be realloc()'ed once, then issue all of the runs' reads at once. (Runs that are physically close together are merged into single vectored reads by `_readAll`.)
+  size_t endOfRuns;
+  std::vector<MyExtent> extents = plan(bufOffset, amountToLoad, volume, &endOfRuns);
+  size_t totalLength = 0;
+  for (const MyExtent& e : extents) {
+    totalLength += e.length;
+  }
+  if (totalLength > 0) {
+    LOG(LOG_DEBUG, "MyDataRuns::load: calling realloc(%p, %zu) aka %f MiB\n", buf, bufOffset+totalLength, (float)(bufOffset+totalLength) / 1024 / 1024);
+    buf = realloc(buf, bufOffset + totalLength);
+  }
+  // Submit all the runs at once and let them complete in any order. Holes (sparse runs) are just zeroed.
+  std::vector<ReadRequest> requests;
+  requests.reserve(extents.size());
+  size_t holeLength = 0;
+  for (const MyExtent& e : extents) {
+    if (e.hole) {
+      memset((uint8_t*)buf + e.offsetInBuf, 0, e.length);
+      holeLength += e.length;
+      continue;
+    }
+    requests.push_back({(uint8_t*)buf + e.offsetInBuf, e.length, e.offsetInVolume});
+  }
+  LOG(LOG_DEBUG, "MyDataRuns::load: reading %zu runs (%zu bytes) and zeroing %zu bytes of holes\n", requests.size(), totalLength - holeLength, holeLength);
+  volume.readAll(requests);
+  prefetch(bufOffset + amountToLoad, volume); // Get the next runs coming while the caller works on this one
+
+  *out_moreNeeded = totalLength < amountToLoad; // Then `amountToLoad` was too large for the runs' contents, or the runs ran out because not enough was loaded.
+  *out_more = (ssize_t)endOfRuns - (ssize_t)(bufOffset + amountToLoad); // Positive if the runs have more after what was loaded, negative if they ran out first.
+
+  return unique_free<void*>((void**)buf);
+}
+
+size_t MyDataRuns::readInto(void* buf, size_t offset, size_t length, const Volume& volume) const {
+  std::vector<ReadRequest> requests;
+  size_t ret = planReads(buf, offset, length, volume, requests);
+  volume.readAll(requests);
+  return ret;
+}
+
+size_t MyDataRuns::planReads(void* buf, size_t offset, size_t length, const Volume& volume, std::vector<ReadRequest>& requests) const {
+  size_t endOfRuns;
+  std::vector<MyExtent> extents = plan(offset, length, volume, &endOfRuns);
+  size_t ret = 0;
+  for (const MyExtent& e : extents) {
+    uint8_t* dest = (uint8_t*)buf + (e.offsetInBuf - offset);
+    if (e.hole) {
+      memset(dest, 0, e.length);
+    }
+    else {
+      requests.push_back({dest, e.length, e.offsetInVolume});
+    }
+    ret += e.length;
+  }
+  return ret;
+}
+
+void MyDataRuns::prefetch(size_t fromOffset, const Volume& volume) const {
+  if (prefetchWindow == 0) {
+    return;
+  }
+  fromOffset = std::max(fromOffset, prefetchedUpTo.value.load(std::memory_order_relaxed));
+  size_t endOfRuns;
+  std::vector<MyExtent> extents = plan(fromOffset, SIZE_MAX - fromOffset, volume, &endOfRuns, prefetchWindow);
+  size_t count = extents.size();
+  for (size_t i = 0; i < count; i++) {
+    if (extents[i].hole) {
+      continue;
+    }
+    LOG(LOG_TRACE, "MyDataRuns::prefetch: prefetching %zu bytes at volume offset %jd\n", extents[i].length, (intmax_t)extents[i].offsetInVolume);
+    volume.prefetch(extents[i].length, extents[i].offsetInVolume);
+  }
+  if (count > 0) {
+    // Only ever move it forwards, in case another thread got further meanwhile. (Two threads can still hint the same runs, which is harmless.)
+    size_t upTo = extents[count-1].offsetInBuf + extents[count-1].length;
+    size_t previous = prefetchedUpTo.value.load(std::memory_order_relaxed);
+    while (previous < upTo && !prefetchedUpTo.value.compare_exchange_weak(previous, upTo, std::memory_order_relaxed)) {}
+  }
+}
+
+void* MyDataRuns::view(size_t bufOffset, size_t amountToLoad, const Volume& volume, bool* out_moreNeeded, ssize_t* out_more) const {
+  size_t endOfRuns;
+  std::vector<MyExtent> extents = plan(bufOffset, amountToLoad, volume, &endOfRuns);
+  if (extents.empty()) {
+    return nullptr;
+  }
+  if (extents[0].hole) {
+    return nullptr; // Holes need a buffer to be zeroed in
+  }
+  size_t totalLength = extents[0].length;
+  for (size_t i = 1; i < extents.size(); i++) {
+    if (extents[i].hole || extents[i].offsetInVolume != extents[i-1].offsetInVolume + (off_t)extents[i-1].length) {
+      return nullptr; // Not physically contiguous, so this needs a copy
+    }
+    totalLength += extents[i].length;
+  }
+  void* ret = volume.view(totalLength, extents[0].offsetInVolume);
+  if (ret != nullptr) {
+    LOG(LOG_DEBUG, "MyDataRuns::view: viewing %zu bytes at volume offset %jd in place\n", totalLength, (intmax_t)extents[0].offsetInVolume);
+    *out_moreNeeded = totalLength < amountToLoad;
+    *out_more = (ssize_t)endOfRuns - (ssize_t)(bufOffset + amountToLoad);
+    prefetch(bufOffset + amountToLoad, volume);
+  }
+  return ret;
+}
+
+Pair<AttributeContentWithFreer, std::optional<MyDataRuns>> NonResidentAttribute::content(size_t limitToLoad, bool* out_moreNeeded, ssize_t* out_more, const Volume& volume) const {
+  // Load all the content virtually (since we can't load it all because it might be massive amounts of data)
+  IOPhaseScope phase(IO_PHASE_ATTRIBUTE_CONTENT);
+  // Grab the runlist
+  RunList* firstRunListEntry = (RunList*)((uint8_t*)this + offsetToTheRunList);
+  // Grab its data runs
+  size_t attrActualSize = 0; // 0 if unknown
+  switch (base.typeIdentifier) {
+  case STANDARD_INFORMATION:
+    attrActualSize = sizeof(StandardInformation);
+    break;
+  case FILE_NAME:
+    attrActualSize = sizeof(FileName);
+    break;
+  case DATA:
+    break;
+  case VOLUME_INFORMATION:
+    attrActualSize = sizeof(VolumeInformation); // "As defined in $AttrDef, this attribute has a minimum and a maximum size of 12 bytes." ( ntfsdoc-0.6/attributes/volume_information.html )
+    break;
+  default:
+    throw UnhandledValue();
+  }
+
+  if (attrActualSize != 0) {
+    if (attrActualSize > limitToLoad) {
+      LOG(LOG_WARN, "NonResidentAttribute::content: warning: attrActualSize > limitToLoad. attrActualSize = %ju, limitToLoad = %ju. This means the whole structure won't be loaded in.\n", (uintmax_t)attrActualSize, (uintmax_t)limitToLoad);
+    }
+    limitToLoad = std::min(limitToLoad, attrActualSize);
+  }
+  MyDataRuns dr = LazilyLoaded{firstRunListEntry, (uint8_t*)this + base.attributeLength}.loadUpTo(integerDivisionRoundingUp(limitToLoad, (size_t)volume.ntfs().bytesPerCluster()));
   size_t bufOffset = 0; unique_free<void*> ptr = nullptr;
-  ptr = dr.load(bufOffset, ptr.get(), limitToLoad, fd, ntfs, out_moreNeeded, out_more);
-  printf("NonResidentAttribute::content: dr.load set out_moreNeeded to %s and out_more to %jd\n", *out_moreNeeded == true ? "true" : "false", (intmax_t)*out_more);
+  void* view = dr.view(bufOffset, limitToLoad, volume, out_moreNeeded, out_more); // View it in place if we can, so nothing needs to be copied or freed
+  if (view == nullptr) {
+    ptr = dr.load(bufOffset, ptr.get(), limitToLoad, volume, out_moreNeeded, out_more);
+  }
+  LOG(LOG_DEBUG, "NonResidentAttribute::content: dr.%s set out_moreNeeded to %s and out_more to %jd\n", view != nullptr ? "view" : "load", *out_moreNeeded == true ? "true" : "false", (intmax_t)*out_more);
+  auto wrap = [&](auto* contentPtr) -> AttributeContentWithFreer {
+    using T = std::remove_pointer_t<decltype(contentPtr)>;
+    if (view != nullptr) {
+      return AttributeContentWithFreer(AttributeContent(contentPtr)); // Not owned
+    }
+    return AttributeContentWithFreer(unique_free<T>((T*)ptr.release()));
+  };
+  void* contentPtr = view != nullptr ? view : ptr.get();
   switch (base.typeIdentifier) {
   case STANDARD_INFORMATION:
-    return {AttributeContentWithFreer(unique_free<StandardInformation>((StandardInformation*)ptr.release())), std::make_optional(dr)};
+    return {wrap((StandardInformation*)contentPtr), std::make_optional(dr)};
   case FILE_NAME:
-    return {AttributeContentWithFreer(unique_free<FileName>((FileName*)ptr.release())), std::make_optional(dr)};
+    return {wrap((FileName*)contentPtr), std::make_optional(dr)};
   case DATA:
-    return {AttributeContentWithFreer(unique_free<Data>((Data*)ptr.release())), std::make_optional(dr)};
+    return {wrap((Data*)contentPtr), std::make_optional(dr)};
   case VOLUME_INFORMATION:
-    return {AttributeContentWithFreer(unique_free<VolumeInformation>((VolumeInformation*)ptr.release())), std::make_optional(dr)};
+    return {wrap((VolumeInformation*)contentPtr), std::make_optional(dr)};
   default:
     throw UnhandledValue();
   }
 }
 
-// Returns the first attribute of type `attributeToFind` within `attributes`, or nullptr if not found.
+// Returns the first attribute of type `attributeToFind` within `record`, or nullptr if not found. Only the attributes before it are looked at, in a single pass over `record.attributeHeaders()`.
 template <typename AttributeContentT>
-std::pair<TypedAttributeContentWithFreer<AttributeContentT>, std::optional<MyDataRuns>> findAttribute(const std::vector<Attribute>& attributes, AttributeTypeIdentifier attributeToFind, size_t limitToLoad /*max amount to load from a non-resident attribute*/, bool* out_moreNeeded /*for non-resident*/, ssize_t* out_more /*for non-resident*/, int fd, NTFS* ntfs) {
-  uint8_t* attrAddress = nullptr;
-  auto attrOfDesiredType = std::find_if(std::begin(attributes), std::end(attributes), [&attributeToFind, &attrAddress](auto attr){
-    bool ret = false;
-    auto process = [&](auto attr) -> bool {
-      if (attr->base.typeIdentifier == attributeToFind) {
-	attrAddress = (uint8_t*)attr;
-	return true;
+std::pair<TypedAttributeContentWithFreer<AttributeContentT>, std::optional<MyDataRuns>> findAttribute(const MFTRecord& record, AttributeTypeIdentifier attributeToFind, size_t limitToLoad /*max amount to load from a non-resident attribute*/, bool* out_moreNeeded /*for non-resident*/, ssize_t* out_more /*for non-resident*/, const Volume& volume) {
+  for (AttributeBase* attr : record.attributeHeaders()) {
+    if (attr->typeIdentifier != attributeToFind) {
+      continue;
+    }
+    return std::visit([&](auto v){auto pair = v->content(limitToLoad, out_moreNeeded, out_more, volume); return std::make_pair(TypedAttributeContentWithFreer<AttributeContentT>(std::move(pair.first)), std::move(pair.second));}, makeAttribute(attr)); // Get content()
+    //AttributeContentT* desiredType = std::get<AttributeContentT*>(content); // Unwrap std::variant
+    //return desiredType; // <-- can't do this because it returns free()'ed memory
+  }
+  return std::make_pair(TypedAttributeContentWithFreer<AttributeContentT>(), std::optional<MyDataRuns>()); // This attribute wasn't found
+}
+
+// "The second #pragma resets the pack value." ( https://stackoverflow.com/questions/24887459/c-c-struct-packing-not-working )
+#pragma pack()
+
+// Per-record results of `_applyFixups`
+enum FixupFlags : uint8_t {
+  FIXUP_OK = 0,
+  FIXUP_BAD_ARRAY = 1 << 0, // The update sequence array doesn't have one entry per sector or doesn't fit in the record
+  FIXUP_TORN = 1 << 1, // The last two bytes of some sector aren't the update sequence number: the sectors of the record weren't all written together (or something else overwrote some of them)
+  FIXUP_SKIP = 1 << 7 // Set by the caller beforehand for records to leave alone, such as ones that weren't read
+};
+
+// Applies the fixups of the `count` consecutive `recordSize`-byte records in `buf` in place, like `MFTRecord::applyFixup` does for one record, and ORs into `flags[i]` the FixupFlags of record i instead of asserting. Records whose flags end up nonzero (or were nonzero already) are left untouched. Returns how many records those are.
+// Checking that every sector ends in its record's update sequence number is what costs something over a whole MFT, since with 1 KiB records there are only two sectors per record to compare. So this goes a group of records at a time: the sector ends of the whole group and the numbers they should be are gathered into two arrays, which are compared eight at a time with SSE2 where available.
+static size_t _applyFixups(uint8_t* buf, size_t count, size_t recordSize, uint16_t bytesPerSector, uint8_t* flags) {
+  const size_t MAX_LANES = 256; // Sector ends compared per group
+  const size_t sectorsPerRecord = bytesPerSector == 0 ? 0 : recordSize / bytesPerSector;
+  if (sectorsPerRecord == 0 || sectorsPerRecord > MAX_LANES || recordSize % bytesPerSector != 0) {
+    for (size_t i = 0; i < count; i++) {
+      flags[i] |= FIXUP_BAD_ARRAY;
+    }
+    return count;
+  }
+  const size_t recordsPerGroup = MAX_LANES / sectorsPerRecord;
+  alignas(16) uint16_t sectorEnds[MAX_LANES];
+  alignas(16) uint16_t expected[MAX_LANES];
+  size_t ret = 0;
+  for (size_t first = 0; first < count; first += recordsPerGroup) {
+    const size_t n = std::min(recordsPerGroup, count - first);
+    const size_t lanes = n * sectorsPerRecord;
+
+    // Gather. Records that won't be checked get lanes that compare equal.
+    for (size_t r = 0; r < n; r++) {
+      const uint8_t* rec = buf + (first + r) * recordSize;
+      const MFTRecord* header = (const MFTRecord*)rec;
+      uint16_t* ends = sectorEnds + r * sectorsPerRecord;
+      uint16_t* usns = expected + r * sectorsPerRecord;
+      if (flags[first + r] == FIXUP_OK && (header->numEntriesInFixupArray != sectorsPerRecord + 1 || header->updateSequenceOffset + header->numEntriesInFixupArray * sizeof(uint16_t) > recordSize)) {
+	flags[first + r] |= FIXUP_BAD_ARRAY;
       }
-      return false;
+      if (flags[first + r] != FIXUP_OK) {
+	std::fill(ends, ends + sectorsPerRecord, 0);
+	std::fill(usns, usns + sectorsPerRecord, 0);
+	continue;
+      }
+      uint16_t usn;
+      memcpy(&usn, rec + header->updateSequenceOffset, sizeof(usn));
+      for (size_t sector = 0; sector < sectorsPerRecord; sector++) {
+	memcpy(&ends[sector], rec + (sector + 1) * bytesPerSector - sizeof(uint16_t), sizeof(uint16_t));
+	usns[sector] = usn;
+      }
+    }
+
+    // Compare
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= lanes; i += 8) {
+      __m128i equal = _mm_cmpeq_epi16(_mm_load_si128((const __m128i*)(sectorEnds + i)), _mm_load_si128((const __m128i*)(expected + i)));
+      unsigned mismatches = ~(unsigned)_mm_movemask_epi8(equal) & 0xFFFF; // Two bits per lane
+      while (mismatches != 0) {
+	unsigned bit = __builtin_ctz(mismatches);
+	flags[first + (i + bit / 2) / sectorsPerRecord] |= FIXUP_TORN;
+	mismatches &= ~(3u << (bit & ~1u));
+      }
+    }
+#endif
+    for (; i < lanes; i++) {
+      if (sectorEnds[i] != expected[i]) {
+	flags[first + i / sectorsPerRecord] |= FIXUP_TORN;
+      }
+    }
+
+    // Apply: the last two bytes of each sector get back what the array saved of them (the array's first entry being the update sequence number)
+    for (size_t r = 0; r < n; r++) {
+      if (flags[first + r] != FIXUP_OK) {
+	ret++;
+	continue;
+      }
+      uint8_t* rec = buf + (first + r) * recordSize;
+      const uint8_t* array = rec + ((const MFTRecord*)rec)->updateSequenceOffset + sizeof(uint16_t);
+      for (size_t sector = 0; sector < sectorsPerRecord; sector++) {
+	memcpy(rec + (sector + 1) * bytesPerSector - sizeof(uint16_t), array + sector * sizeof(uint16_t), sizeof(uint16_t));
+      }
+    }
+  }
+  return ret;
+}
+
+// The magic number at the start of a record, e.g. `_magicNumber("FILE")`, as a little-endian 32-bit value so that it can be compared in one go.
+constexpr uint32_t _magicNumber(const char (&magic)[5]) {
+  return (uint32_t)(uint8_t)magic[0] | (uint32_t)(uint8_t)magic[1] << 8 | (uint32_t)(uint8_t)magic[2] << 16 | (uint32_t)(uint8_t)magic[3] << 24;
+}
+
+// Checks the header of the `recordSize`-byte record `rec` before its fixups are applied: everything that has to be in bounds before `_applyFixups` and `_checkRecordAttributes` can look at it. This runs on every record of a scan, so the bounds are combined without a branch for each and a damaged record costs about as much as a good one.
+static RecordCheck _checkRecordHeader(const MFTRecord* rec, size_t recordSize, uint16_t bytesPerSector) {
+  uint32_t magic;
+  memcpy(&magic, rec->magicNumber, sizeof(magic));
+  magic = le32toh(magic);
+  if (magic != _magicNumber("FILE")) {
+    return magic == 0 ? RECORD_EMPTY : magic == _magicNumber("BAAD") ? RECORD_BAAD : RECORD_BAD_MAGIC;
+  }
+  if (!(rec->flags & RecordInUse)) {
+    return RECORD_EMPTY;
+  }
+  const size_t arrayStart = rec->updateSequenceOffset;
+  const size_t arrayEnd = arrayStart + rec->numEntriesInFixupArray * sizeof(uint16_t);
+  const size_t firstAttribute = rec->offsetToFirstAttribute;
+  const size_t used = rec->usedSizeOfMFTEntry;
+  bool bad = (arrayStart < offsetof(MFTRecord, padding10)) | (arrayStart % 2 != 0) // (At 0x2a on NTFS 3.0, 0x30 since)
+    | (rec->numEntriesInFixupArray != recordSize / bytesPerSector + 1) | (arrayEnd > firstAttribute)
+    | (firstAttribute % 8 != 0) | (firstAttribute + sizeof(uint32_t) > used) // (Room for at least the end marker)
+    | (used > rec->allocatedSizeOfMFTEntry) | (rec->allocatedSizeOfMFTEntry != recordSize);
+  return bad ? RECORD_BAD_HEADER : RECORD_OK;
+}
+
+// Walks the attribute headers of `rec`, which passed `_checkRecordHeader` and has been fixed up, checking that each one is a whole attribute within the used part of the record, that the runlists of non-resident ones are well formed within them, and that they end in the end marker. Every length is at least a header long, so a corrupt length of zero can't make this (or anything iterating afterwards) go around in place.
+static RecordCheck _checkRecordAttributes(const MFTRecord* rec) {
+  const uint8_t* pos = (const uint8_t*)rec + rec->offsetToFirstAttribute;
+  const uint8_t* end = (const uint8_t*)rec + rec->usedSizeOfMFTEntry;
+  while ((size_t)(end - pos) >= sizeof(uint32_t)) {
+    const size_t remaining = end - pos;
+    const AttributeBase* attr = (const AttributeBase*)pos;
+    if (attr->typeIdentifier == 0xffffffff) {
+      return RECORD_OK;
+    }
+    if (remaining < sizeof(AttributeBase)) {
+      break;
+    }
+    const size_t length = attr->attributeLength;
+    bool bad = (length < sizeof(AttributeBase)) | (length % 8 != 0) | (length > remaining)
+      | ((attr->lengthOfName != 0) & (attr->offsetToName + attr->lengthOfName * sizeof(uint16_t) > length));
+    if (!bad) {
+      if (attr->nonResidentFlag == 0) {
+	const ResidentAttribute* resident = (const ResidentAttribute*)attr;
+	bad = length < sizeof(ResidentAttribute) || resident->offsetToContent + (size_t)resident->sizeOfContent > length;
+      }
+      else {
+	const NonResidentAttribute* nonResident = (const NonResidentAttribute*)attr;
+	bad = length < sizeof(NonResidentAttribute) || nonResident->offsetToTheRunList >= length
+	  || !RunList::isValid((const RunList*)(pos + nonResident->offsetToTheRunList), pos + length); // (The runlist being the deepest thing that gets parsed)
+      }
+    }
+    if (bad) {
+      return RECORD_BAD_ATTRIBUTES;
+    }
+    pos += length;
+  }
+  return RECORD_BAD_ATTRIBUTES; // No end marker
+}
+
+PooledMFTRecord Volume::getRecord(uint64_t recordNumber, RecordCheck* out_check) const {
+  const uint16_t bytesPerSector = ntfs().bytesPerSector;
+  PooledMFTRecord rec;
+  bool read = false;
+  RecordCheck check = RECORD_OUT_OF_RANGE;
+  if (recordNumber == 0) {
+    rec = getFirstMFTRecord(); // (Where the boot sector says, since the MFT's runs are in this record)
+    read = true;
+  }
+  else {
+    uint64_t mftSize;
+    const MyDataRuns& runs = mftRuns(&mftSize); // (Counted as an MFT load the first time)
+    IOPhaseScope phase(IO_PHASE_RECORD_NAVIGATION);
+    rec = acquireRecord();
+    if (recordNumber < mftSize / rec.size()) {
+      read = runs.readInto(rec.get(), recordNumber * rec.size(), rec.size(), *this) == rec.size();
+      if (!read) {
+	check = RECORD_MFT_INCOMPLETE; // (See `mftDataRuns`)
+      }
+    }
+  }
+  const size_t recordSize = rec.size();
+  if (read) {
+    check = _checkRecordHeader(rec.get(), recordSize, bytesPerSector);
+    if (check == RECORD_OK) {
+      uint8_t flags = FIXUP_OK;
+      _applyFixups((uint8_t*)rec.get(), 1, recordSize, bytesPerSector, &flags);
+      check = flags != FIXUP_OK ? RECORD_TORN : _checkRecordAttributes(rec.get());
+    }
+  }
+  if (out_check != nullptr) {
+    *out_check = check;
+  }
+  if (check != RECORD_OK) {
+    LOG(LOG_DEBUG, "Volume::getRecord: record %ju: %s\n", (uintmax_t)recordNumber, recordCheckName(check));
+    return PooledMFTRecord();
+  }
+  return rec;
+}
+
+const MFTRecord& Volume::mftRecord() const {
+  std::call_once(mftRecordLoaded, [this]() {
+    IOPhaseScope phase(IO_PHASE_MFT_LOAD);
+    RecordCheck check;
+    PooledMFTRecord rec = getRecord(0, &check);
+    if (rec.get() == nullptr) {
+      fprintf(stderr, "Volume::mftRecord: the first MFT record of the volume at offset %llu is unusable: %s\n", seekBase, recordCheckName(check));
+      throw UnhandledValue();
+    }
+    mftRecordCache = std::move(rec);
+  });
+  return *mftRecordCache;
+}
+
+// Reads the whole MFT of a volume front to back in large chunks (rather than a record at a time), applies the fixups in place and hands each usable record to a visitor. The next chunk is read in the background on `_threadPool()` while the current one is visited, so a full enumeration is limited by the disk rather than by waiting on it between records. Records that the MFT's $BITMAP says are unallocated are neither read nor parsed, which on a volume whose MFT is mostly empty slots saves most of the I/O.
+const size_t MFT_SCAN_CHUNK_SIZE = 16 * 1024 * 1024; // Default `MFTScanner` chunk size
+class MFTScanner {
+public:
+  struct Stats {
+    uint64_t recordsScanned = 0;
+    uint64_t recordsSkipped = 0; // Read but never written or not in use (RECORD_EMPTY)
+    uint64_t recordsCorrupt = 0; // Read but rejected by `_checkRecordHeader` or `_checkRecordAttributes` for any other reason
+    uint64_t recordsTorn = 0; // Read but with a fixup array that doesn't fit or sectors that don't end in the update sequence number (see `_applyFixups`)
+    uint64_t recordsUnallocated = 0; // Not read at all because the MFT's $BITMAP says they aren't in use
+    uint64_t bytesRead = 0;
+
+    void add(const Stats& other) {
+      recordsScanned += other.recordsScanned;
+      recordsSkipped += other.recordsSkipped;
+      recordsTorn += other.recordsTorn;
+      recordsCorrupt += other.recordsCorrupt;
+      recordsUnallocated += other.recordsUnallocated;
+      bytesRead += other.bytesRead;
+    }
+  };
+
+  // `skipUnallocated` loads the MFT's $BITMAP so that unallocated records can be skipped. Turn it off to look at every record slot, e.g. for the remains of deleted files.
+  MFTScanner(const Volume& vol_, size_t chunkSize_ = MFT_SCAN_CHUNK_SIZE, bool skipUnallocated = true): vol(vol_), recordSize(vol_.ntfs().bytesPerMFTFileRecord()) {
+    vol.mftRunList(&mftSize); // (Just for the size: the runs are decoded by `scan` and `parallelScan`)
+    chunkSize = std::max(chunkSize_ / recordSize, (size_t)1) * recordSize; // Whole records only
+    if (skipUnallocated) {
+      bitmap = vol.mftBitmap();
+    }
+  }
+
+  MFTScanner(const MFTScanner& other) = delete;
+
+  uint64_t numRecords() const { return mftSize / recordSize; }
+
+  // Whether record `record` is in use according to the MFT's $BITMAP. True for all records if the bitmap wasn't loaded (or doesn't cover `record`).
+  bool isAllocated(uint64_t record) const {
+    return record / 8 >= bitmap.size() || (bitmap[record / 8] >> (record % 8)) & 1;
+  }
+
+  // Calls `visit(recordNumber, record)` with an `MFTRecord*` for each usable record in [firstRecord, endRecord), in order, with its fixups applied. `record` points into a chunk buffer that is reused, so it is only valid during the call.
+  template <typename Visitor>
+  Stats scan(Visitor&& visit, uint64_t firstRecord = 0, uint64_t endRecord = UINT64_MAX) const {
+    Stats stats;
+    endRecord = std::min(endRecord, numRecords());
+    if (firstRecord >= endRecord) {
+      return stats;
+    }
+    const size_t recordsPerChunk = chunkSize / recordSize;
+    const size_t bytesPerCluster = vol.ntfs().bytesPerCluster();
+    // The MFT's runs are streamed through rather than all decoded up front: each chunk's are decoded just before it is read and let go of once it has been, so only those of the two chunks in use are held however big the MFT is
+    LazilyLoaded mft = vol.mftRunList();
+    auto loadRunsFor = [&](uint64_t record, size_t count) {
+      mft.loadUpTo(integerDivisionRoundingUp((record + count) * recordSize, (uint64_t)bytesPerCluster));
     };
-    ret = std::visit([&](auto v){return process(v);}, attr);
+    unique_free<uint8_t> buffers[2] = {allocateChunk(), allocateChunk()}; // One being visited and one being read into
+    uint64_t bytesRead;
+    size_t count = std::min((uint64_t)recordsPerChunk, endRecord - firstRecord);
+    loadRunsFor(firstRecord, count);
+    count = readRecords(buffers[0].get(), firstRecord, count, mft.loaded, &bytesRead);
+    uint64_t record = firstRecord;
+    while (count > 0) {
+      uint8_t* buf = buffers[0].get();
+      uint64_t nextRecord = record + count;
+      size_t nextCount = 0;
+      uint64_t nextBytesRead = 0;
+      TaskGroup readAhead(_threadPool());
+      if (nextRecord < endRecord) {
+	nextCount = std::min((uint64_t)recordsPerChunk, endRecord - nextRecord);
+	loadRunsFor(nextRecord, nextCount); // (Before the read starts, since it reads `mft.loaded`)
+	readAhead.run([&](){ nextCount = readRecords(buffers[1].get(), nextRecord, nextCount, mft.loaded, &nextBytesRead); });
+      }
+
+      stats.bytesRead += bytesRead;
+      visitChunk(buf, record, count, stats, visit);
+
+      readAhead.wait();
+      mft.loaded.dropBefore((nextRecord + nextCount) * recordSize / bytesPerCluster); // (Keeping the run that the next chunk starts in, which may be shared with this one's last record)
+      std::swap(buffers[0], buffers[1]);
+      record = nextRecord;
+      count = nextCount;
+      bytesRead = nextBytesRead;
+    }
+    if (record < endRecord) {
+      LOG(LOG_ERROR, "MFTScanner::scan: the runs in the first MFT record end at record %ju of the MFT's %ju (see `Volume::mftDataRuns`)\n", (uintmax_t)record, (uintmax_t)numRecords());
+    }
+    LOG(LOG_DEBUG, "MFTScanner::scan: %ju records scanned, %ju skipped, %ju torn, %ju corrupt, %ju unallocated, %ju bytes read\n", (uintmax_t)stats.recordsScanned, (uintmax_t)stats.recordsSkipped, (uintmax_t)stats.recordsTorn, (uintmax_t)stats.recordsCorrupt, (uintmax_t)stats.recordsUnallocated, (uintmax_t)stats.bytesRead);
+    return stats;
+  }
+
+  // Like `scan` but visits records on all of `_threadPool()`'s threads at once, for when visiting (parsing) them costs more than reading them. The records are split into chunks that each worker reads into its own buffer and visits, claiming the next chunk when it is done (see `parallelFor`). `visit(recordNumber, record, out)` is called concurrently for different chunks and appends whatever it wants to keep to `out`, a std::vector<T> for the chunk; these are concatenated in chunk order at the end, so the result is in record order and the same however the chunks were scheduled. `out_stats` is set to the totals if it isn't nullptr.
+  template <typename T, typename Visitor>
+  std::vector<T> parallelScan(Visitor&& visit, Stats* out_stats = nullptr, uint64_t firstRecord = 0, uint64_t endRecord = UINT64_MAX) const {
+    endRecord = std::min(endRecord, numRecords());
+    uint64_t total = firstRecord < endRecord ? endRecord - firstRecord : 0;
+    ThreadPool& pool = _threadPool();
+    // Chunks of at most `chunkSize`, but small enough that every worker gets several, so that the load evens out
+    const size_t recordsPerChunk = std::max((uint64_t)1, std::min((uint64_t)(chunkSize / recordSize), total / (pool.size() * 4)));
+    const size_t numChunks = integerDivisionRoundingUp(total, (uint64_t)recordsPerChunk);
+    std::vector<std::vector<T>> outputs(numChunks);
+    std::vector<Stats> chunkStats(numChunks);
+    std::vector<unique_free<uint8_t>> buffers(std::min(pool.size(), numChunks)); // Per worker, allocated on first use
+    const MyDataRuns& mft = vol.mftRuns(); // (All of them, since the chunks are read in any order)
+    parallelFor(pool, numChunks, [&](size_t c, size_t worker){
+      if (buffers[worker] == nullptr) {
+	buffers[worker] = allocateChunk();
+      }
+      uint64_t record = firstRecord + c * recordsPerChunk;
+      size_t count = readRecords(buffers[worker].get(), record, std::min((uint64_t)recordsPerChunk, endRecord - record), mft, &chunkStats[c].bytesRead);
+      std::vector<T>& out = outputs[c];
+      visitChunk(buffers[worker].get(), record, count, chunkStats[c], [&](uint64_t recordNumber, MFTRecord* rec){ visit(recordNumber, rec, out); });
+    });
+
+    size_t totalOutputs = 0;
+    for (const std::vector<T>& out : outputs) {
+      totalOutputs += out.size();
+    }
+    std::vector<T> ret;
+    ret.reserve(totalOutputs);
+    Stats stats;
+    for (size_t c = 0; c < numChunks; c++) {
+      std::move(outputs[c].begin(), outputs[c].end(), std::back_inserter(ret));
+      stats.add(chunkStats[c]);
+    }
+    if (out_stats != nullptr) {
+      *out_stats = stats;
+    }
     return ret;
-  });
-  if (attrOfDesiredType == std::end(attributes)) {
-    return std::make_pair(TypedAttributeContentWithFreer<AttributeContentT>(), std::optional<MyDataRuns>()); // This attribute wasn't found
   }
-  std::pair<TypedAttributeContentWithFreer<AttributeContentT>, std::optional<MyDataRuns>> content = std::visit([&](auto v){auto pair = v->content(limitToLoad, out_moreNeeded, out_more, fd, ntfs); return std::make_pair(TypedAttributeContentWithFreer<AttributeContentT>(std::move(pair.first)), std::move(pair.second));}, *attrOfDesiredType); // Get content()
-  //AttributeContentT* desiredType = std::get<AttributeContentT*>(content); // Unwrap std::variant
-  //return desiredType; // <-- can't do this because it returns free()'ed memory
-  
-  return content;
+
+protected:
+  const Volume& vol;
+  const size_t recordSize;
+  size_t chunkSize; // In bytes, a multiple of `recordSize`
+  uint64_t mftSize; // In bytes
+  std::vector<uint8_t> bitmap; // The MFT's $BITMAP, or empty to read every record
+
+  // Reads records [firstRecord, firstRecord + count) into `buf`, each at its index within the range, but only the allocated ones (see `isAllocated`): each run of consecutive allocated records becomes reads and the unallocated ones between them are left out of the plan, like holes, so their slots in `buf` keep whatever was there. (Short gaps may still be read and thrown away by `_readAll`'s coalescing, which is cheaper than another I/O.) Returns how many of the records `mft` (the MFT's runs, or at least those of these records) covers, and sets `out_bytesRead`.
+  size_t readRecords(uint8_t* buf, uint64_t firstRecord, size_t count, const MyDataRuns& mft, uint64_t* out_bytesRead) const {
+    IOPhaseScope phase(IO_PHASE_MFT_SCAN);
+    uint64_t recordsInRuns = mft.endVCN() * vol.ntfs().bytesPerCluster() / recordSize;
+    count = std::min((uint64_t)count, recordsInRuns > firstRecord ? recordsInRuns - firstRecord : 0);
+    std::vector<ReadRequest> requests;
+    uint64_t bytesRead = 0;
+    for (size_t i = 0; i < count; ) {
+      uint64_t record = firstRecord + i;
+      if (!isAllocated(record)) {
+	i += (record % 8 == 0 && record / 8 < bitmap.size() && bitmap[record / 8] == 0) ? std::min((size_t)8, count - i) : 1; // (Whole bytes of the bitmap at a time where it is empty)
+	continue;
+      }
+      size_t end = i + 1;
+      while (end < count && isAllocated(firstRecord + end)) {
+	end++;
+      }
+      bytesRead += mft.planReads(buf + i * recordSize, record * recordSize, (end - i) * recordSize, vol, requests);
+      i = end;
+    }
+    vol.readAll(requests, false); // (Bypassing the cluster cache: see `Volume::readAll`)
+    *out_bytesRead = bytesRead;
+    return count;
+  }
+
+  // Checks each of the `count` records in `buf` (the first being record number `firstRecord`), fixes up the ones whose headers are sound, checks their attributes and passes the usable ones to `visit`, counting the rest by what is wrong with them. Unallocated records are passed over without being looked at, since `readRecords` didn't read them. This goes a batch at a time, so that the records are still in cache when visited.
+  template <typename Visitor>
+  void visitChunk(uint8_t* buf, uint64_t firstRecord, size_t count, Stats& stats, Visitor&& visit) const {
+    const uint16_t bytesPerSector = vol.ntfs().bytesPerSector;
+    const size_t BATCH_SIZE = 64; // Records
+    uint8_t flags[BATCH_SIZE];
+    RecordCheck checks[BATCH_SIZE];
+    for (size_t batch = 0; batch < count; batch += BATCH_SIZE) {
+      const size_t n = std::min(BATCH_SIZE, count - batch);
+      for (size_t i = 0; i < n; i++) {
+	if (!isAllocated(firstRecord + batch + i)) {
+	  flags[i] = FIXUP_SKIP;
+	  continue;
+	}
+	checks[i] = _checkRecordHeader((MFTRecord*)(buf + (batch + i) * recordSize), recordSize, bytesPerSector);
+	flags[i] = checks[i] == RECORD_OK ? FIXUP_OK : FIXUP_SKIP;
+      }
+      _applyFixups(buf + batch * recordSize, n, recordSize, bytesPerSector, flags);
+      for (size_t i = 0; i < n; i++) {
+	const uint64_t recordNumber = firstRecord + batch + i;
+	MFTRecord* rec = (MFTRecord*)(buf + (batch + i) * recordSize);
+	stats.recordsScanned++;
+	if (!isAllocated(recordNumber)) {
+	  stats.recordsUnallocated++;
+	  continue;
+	}
+	if (checks[i] == RECORD_OK) {
+	  if (flags[i] != FIXUP_OK) {
+	    stats.recordsTorn++;
+	    LOG(LOG_DEBUG, "MFTScanner: record %ju failed its fixup check (flags %#x)\n", (uintmax_t)recordNumber, (unsigned)flags[i]);
+	    continue;
+	  }
+	  checks[i] = _checkRecordAttributes(rec);
+	}
+	if (checks[i] == RECORD_EMPTY) {
+	  stats.recordsSkipped++;
+	  continue;
+	}
+	if (checks[i] != RECORD_OK) {
+	  stats.recordsCorrupt++;
+	  LOG(LOG_DEBUG, "MFTScanner: record %ju rejected: %s\n", (uintmax_t)recordNumber, recordCheckName(checks[i]));
+	  continue;
+	}
+	visit(recordNumber, rec);
+      }
+    }
+  }
+
+  unique_free<uint8_t> allocateChunk() const {
+    void* ret;
+    int err = posix_memalign(&ret, 4096, chunkSize); // Page-aligned so that O_DIRECT can read straight into it
+    if (err != 0) {
+      errno = err;
+      perror("posix_memalign failed");
+      throw err;
+    }
+    return unique_free<uint8_t>((uint8_t*)ret);
+  }
+};
+
+// Returns the name in the first $FILE_NAME attribute of `rec`, or an empty string if it has none.
+std::string _fileNameOf(const MFTRecord* rec) {
+  for (AttributeBase* attr : rec->attributeHeaders()) {
+    if (attr->typeIdentifier != FILE_NAME || attr->nonResidentFlag != 0) {
+      continue;
+    }
+    FileName* fileName = (FileName*)((ResidentAttribute*)attr)->boundedContent(sizeof(FileName));
+    if (fileName == nullptr || ((ResidentAttribute*)attr)->sizeOfContent < sizeof(FileName) + fileName->fileNameInUnicode().byteLength()) {
+      continue;
+    }
+    return fileName->fileNameInUnicode().to_string();
+  }
+  return std::string();
 }
 
-// "The second #pragma resets the pack value." ( https://stackoverflow.com/questions/24887459/c-c-struct-packing-not-working )
-#pragma pack()
+// What a listing of the files on a volume needs from one MFT record, copied out of it so that it outlives the scan's buffers.
+struct ParsedRecord {
+  uint64_t recordNumber;
+  uint64_t baseRecordNumber; // Same as `recordNumber` for base records, otherwise the base record this is an extension of
+  uint16_t sequenceNumber;
+  MFTEntryFlags flags;
+  uint64_t parentRecordNumber = 0; // From $FILE_NAME
+  std::string name; // From the first $FILE_NAME that isn't a DOS (8.3) name, or the DOS name if that is all there is. Empty if there is no $FILE_NAME.
+  uint64_t size = 0; // Of the unnamed $DATA attribute
+  bool hasStandardInformation = false;
+  Times times = {}; // From $STANDARD_INFORMATION
+  uint32_t dosPermissions = 0; // From $STANDARD_INFORMATION
+};
 
-int main(int argc, char** argv) {
-  if (argc < 2) {
-    printf("Need at least one argument: the file to open as an NTFS partition. Alternatively, provide any file and an offset to seek within the file (you can also provide an entire disk, then seek to the NTFS partition).");
-    return 1;
+// Extracts the $FILE_NAME, $STANDARD_INFORMATION and unnamed $DATA size of record number `recordNumber`, whose fixups have been applied, in one pass over its attributes.
+ParsedRecord _parseRecord(uint64_t recordNumber, const MFTRecord* rec) {
+  static const uint8_t DOS_NAMESPACE = 2; // `FileName::filenameNamespace` of 8.3 names
+  ParsedRecord ret;
+  ret.recordNumber = recordNumber;
+  ret.baseRecordNumber = rec->isBaseRecord() ? recordNumber : rec->fileReferenceToTheBase_FILE_record & 0xffffffffffff; // (The low 48 bits of a file reference are the record number)
+  ret.sequenceNumber = rec->sequenceNumber;
+  ret.flags = rec->flags;
+  bool haveName = false, haveLongName = false;
+  for (AttributeBase* attr : rec->attributeHeaders()) {
+    if (attr->nonResidentFlag == 1) {
+      if (attr->typeIdentifier == DATA && attr->lengthOfName == 0) {
+	ret.size = ((NonResidentAttribute*)attr)->actualSizeOfTheAttributeContent;
+      }
+      continue;
+    }
+    ResidentAttribute* resident = (ResidentAttribute*)attr;
+    switch (attr->typeIdentifier) {
+    case STANDARD_INFORMATION: {
+      StandardInformation* si = (StandardInformation*)resident->boundedContent(offsetof(StandardInformation, dosPermissions) + sizeof(uint32_t)); // (The fields after these were added in NTFS 3.0)
+      if (si != nullptr && !ret.hasStandardInformation) {
+	ret.hasStandardInformation = true;
+	ret.times = si->times;
+	ret.dosPermissions = si->dosPermissions;
+      }
+      break;
+    }
+    case FILE_NAME: {
+      FileName* fileName = (FileName*)resident->boundedContent(sizeof(FileName));
+      if (fileName == nullptr || haveLongName || resident->sizeOfContent < sizeof(FileName) + fileName->fileNameInUnicode().byteLength()) {
+	break;
+      }
+      bool isDOSName = fileName->filenameNamespace == DOS_NAMESPACE;
+      if (haveName && isDOSName) {
+	break;
+      }
+      ret.name = fileName->fileNameInUnicode().to_string();
+      ret.parentRecordNumber = fileName->fileReferenceToParentDirectory & 0xffffffffffff;
+      haveName = true;
+      haveLongName = !isDOSName;
+      break;
+    }
+    case DATA:
+      if (attr->lengthOfName == 0) {
+	ret.size = resident->sizeOfContent;
+      }
+      break;
+    default:
+      break;
+    }
   }
-  int fd = _open(argv[1], O_RDONLY);
-  if (argc > 2) {
-    unsigned long long seekInFD = std::stoull(argv[2]);
-    // Seek within the fd given using this amount
-    _lseek_setSeekBase(seekInFD);
-    _lseek(fd, 0, SEEK_SET); // Will now be relative to our `seekInFD`
+  return ret;
+}
+
+// How fragmented one file's unnamed $DATA attribute is. All lengths and distances are in clusters.
+struct FileFragmentation {
+  uint64_t recordNumber; // Of the file's base record
+  size_t extents = 0; // Runs with clusters on disk (sparse runs aren't counted since they don't need a seek)
+  uint64_t largestExtent = 0;
+  uint64_t smallestExtent = UINT64_MAX;
+  uint64_t totalSeekDistance = 0; // Sum of the distances from the end of each extent to the start of the next
+  size_t seeks = 0; // Number of distances in `totalSeekDistance`
+  std::vector<size_t> runIds; // Ids in `FragmentationReport::runs` of the runs of the file's $DATA, one per record it is in (the base record's first)
+
+  double averageSeekDistance() const {
+    return seeks == 0 ? 0 : (double)totalSeekDistance / seeks;
   }
 
-  struct NTFS buf;
-  _read(fd, &buf, sizeof(NTFS));
-  printf("mftOffset: %ju %ju\n", (uintmax_t)buf.mftOffset, (uintmax_t)(buf.mftOffset * buf.bytesPerCluster()));
+  // Counts the runs that `it` decodes, the part of the file's $DATA that is in one record.
+  void measure(MyCompactRuns::Iterator it) {
+    MyRunExtent e;
+    size_t extentsBefore = extents;
+    int64_t previousEnd = 0;
+    while (it.next(&e)) {
+      if (e.sparse) {
+	continue;
+      }
+      if (extents > extentsBefore) {
+	totalSeekDistance += e.lcn > previousEnd ? e.lcn - previousEnd : previousEnd - e.lcn;
+	seeks++;
+      }
+      extents++;
+      largestExtent = std::max(largestExtent, e.length);
+      smallestExtent = std::min(smallestExtent, e.length);
+      previousEnd = e.lcn + e.length;
+    }
+  }
 
-  if (argc > 3) {
-    const char* cmd = argv[3];
-    // Optional "command"
-    if (strcmp(cmd, "rec") == 0) {
-      // Read record at addr
-      
-      long long seekToAddr;
-      // printf("Enter a number of sectors to seek to in order to grab an MFT record there: ");
-      // int ret = scanf(" %d", &seekToAddr);
-      // if (ret == EOF) {
-      // 	perror("scanf failed");
-      // }
-      // int expected = 1;
-      // if (ret < expected) {
-      // 	printf("Not enough grabbed by scanf (got %d out of %d). Exiting.\n", ret, expected);
-      // 	return 1;
-      // }
+  // Adds the runs of `other`, a later part of the same file's $DATA that is in an extension record.
+  void merge(const FileFragmentation& other) {
+    extents += other.extents;
+    largestExtent = std::max(largestExtent, other.largestExtent);
+    smallestExtent = std::min(smallestExtent, other.smallestExtent);
+    totalSeekDistance += other.totalSeekDistance;
+    seeks += other.seeks;
+    runIds.insert(runIds.end(), other.runIds.begin(), other.runIds.end());
+  }
+};
 
-      if (argc < 4) {
-	printf("Need another argument. Exiting.\n");
-	return 1;
+// The fragmentation of every file with a non-resident unnamed $DATA attribute on a volume, to decide whether it is worth defragmenting.
+struct FragmentationReport {
+  static const size_t HISTOGRAM_BUCKETS = 24; // Bucket i holds the files with [2^i, 2^(i+1)) extents (the last also holds any more than that)
+
+  std::vector<FileFragmentation> files; // In order of record number (except for files only found in extension records, which come last)
+  MyCompactRuns runs; // The runs of every file in `files`, i.e. an extent map of the whole volume, by `FileFragmentation::runIds`
+  uint64_t histogram[HISTOGRAM_BUCKETS] = {};
+  MFTScanner::Stats scanStats;
+
+  static size_t bucketFor(size_t extents) {
+    size_t bucket = extents <= 1 ? 0 : 63 - __builtin_clzll(extents);
+    return std::min(bucket, HISTOGRAM_BUCKETS - 1);
+  }
+
+  // Prints the volume-wide summary and histogram, then a line for every file with more than one extent if `perFile`.
+  void print(FILE* f, bool perFile) const {
+    uint64_t fragmented = 0, totalExtents = 0;
+    for (const FileFragmentation& file : files) {
+      totalExtents += file.extents;
+      if (file.extents > 1) {
+	fragmented++;
       }
-      seekToAddr = std::stoll(argv[4]);
-      // Seek to it and grab an MFT record
-      off_t dest = seekToAddr * buf.bytesPerSector;
-      printf("buf.bytesPerSector: %ju, dest in sectors: %jd dest in bytes: %jd\n", (uintmax_t)buf.bytesPerSector, (intmax_t)seekToAddr, (intmax_t)dest);
-      _lseek(fd, dest, SEEK_SET);
-      MFTRecord buf2;
-      _read(fd, &buf2, sizeof(MFTRecord));
-  
-      BREAKPOINT;
-      return 0;
     }
-    else {
-      printf("Unknown command\n");
-      return 1;
+    fprintf(f, "Fragmentation: %ju records scanned (%ju skipped, %ju torn, %ju corrupt, %ju unallocated), %zu files with non-resident data, %ju of them fragmented, %.2f extents per file on average\n", (uintmax_t)scanStats.recordsScanned, (uintmax_t)scanStats.recordsSkipped, (uintmax_t)scanStats.recordsTorn, (uintmax_t)scanStats.recordsCorrupt, (uintmax_t)scanStats.recordsUnallocated, files.size(), (uintmax_t)fragmented, files.empty() ? 0.0 : (double)totalExtents / files.size());
+    fprintf(f, "  Extent map of the volume: %zu runlists kept in %zu bytes\n", runs.size(), runs.memoryUsage());
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+      if (histogram[i] > 0) {
+	fprintf(f, "  %10ju - %10ju extents: %ju files\n", (uintmax_t)1 << i, ((uintmax_t)1 << (i + 1)) - 1, (uintmax_t)histogram[i]);
+      }
+    }
+    if (!perFile) {
+      return;
+    }
+    for (const FileFragmentation& file : files) {
+      if (file.extents > 1) {
+	fprintf(f, "  record %ju: %zu extents, largest %ju clusters, smallest %ju clusters, average seek distance %.1f clusters\n", (uintmax_t)file.recordNumber, file.extents, (uintmax_t)file.largestExtent, (uintmax_t)file.smallestExtent, file.averageSeekDistance());
+      }
+    }
+  }
+};
+
+// Measures the fragmentation of the unnamed $DATA attribute of every file in the MFT that `scanner` scans. The records are parsed in parallel (see `MFTScanner::parallelScan`) and the results come back in record order, so the report is the same however the work was scheduled.
+FragmentationReport analyzeFragmentation(const MFTScanner& scanner) {
+  struct Part {
+    FileFragmentation file; // `recordNumber` is the base record's
+    bool isExtension; // Whether this is from an extension record rather than the base record
+    bool corrupt; // Whether the runlist was corrupt, in which case `file` is to be ignored and the record counted as corrupt
+    std::vector<uint8_t> encodedRuns; // For `FragmentationReport::runs` (see `MyCompactRuns::encode`), encoded by the worker that parsed the record so that it happens in parallel
+  };
+  FragmentationReport report;
+  std::vector<Part> parts = scanner.parallelScan<Part>([](uint64_t recordNumber, MFTRecord* rec, std::vector<Part>& out){
+    for (AttributeBase* attr : rec->attributeHeaders()) {
+      if (attr->typeIdentifier != DATA || attr->nonResidentFlag != 1 || attr->lengthOfName != 0) {
+	continue;
+      }
+      const NonResidentAttribute* nonResident = (const NonResidentAttribute*)attr;
+      FileFragmentation file;
+      file.recordNumber = rec->isBaseRecord() ? recordNumber : rec->fileReferenceToTheBase_FILE_record & 0xffffffffffff; // (The low 48 bits of a file reference are the record number)
+      if (nonResident->offsetToTheRunList >= attr->attributeLength) {
+	out.push_back({file, !rec->isBaseRecord(), true, {}});
+	break;
+      }
+      LazilyLoaded runList{(RunList*)((uint8_t*)nonResident + nonResident->offsetToTheRunList), (uint8_t*)attr + attr->attributeLength};
+      const MyDataRuns& runs = runList.loadUpTo(SIZE_MAX);
+      if (runs.cursor->corrupt) {
+	out.push_back({file, !rec->isBaseRecord(), true, {}});
+	break;
+      }
+      if (std::any_of(runs.index.begin(), runs.index.end(), [](const MyRunExtent& e){ return !e.sparse; })) {
+	out.push_back({file, !rec->isBaseRecord(), false, MyCompactRuns::encode(runs)});
+      }
     }
+  }, &report.scanStats);
+
+  // Merge in record order, folding extension records' runs into their base record's file
+  std::unordered_map<uint64_t, size_t> indexOfRecord; // Into `report.files`
+  std::vector<FileFragmentation> orphans; // Extension records whose base record comes later (or not at all)
+  auto add = [&](const FileFragmentation& file) {
+    auto it = indexOfRecord.find(file.recordNumber);
+    if (it != indexOfRecord.end()) {
+      report.files[it->second].merge(file);
+      return;
+    }
+    indexOfRecord[file.recordNumber] = report.files.size();
+    report.files.push_back(file);
+  };
+  for (Part& part : parts) {
+    if (part.corrupt) {
+      report.scanStats.recordsCorrupt++;
+      continue;
+    }
+    size_t id = report.runs.add(part.encodedRuns);
+    part.encodedRuns = std::vector<uint8_t>(); // (Freeing it now that it is in the arena)
+    part.file.runIds.push_back(id);
+    part.file.measure(report.runs.runs(id)); // (From the store, which is all that is kept of the runs)
+    if (part.isExtension && indexOfRecord.count(part.file.recordNumber) == 0) {
+      orphans.push_back(part.file);
+      continue;
+    }
+    add(part.file);
+  }
+  for (const FileFragmentation& file : orphans) {
+    add(file);
+  }
+  for (const FileFragmentation& file : report.files) {
+    report.histogram[FragmentationReport::bucketFor(file.extents)]++;
   }
+  return report;
+}
+
+// Finds $Volume in the MFT of `vol` and prints where its $VOLUME_INFORMATION flags are. Returns 0 on success or 1 if something needed wasn't found.
+int scanVolume(const Volume& vol) {
+  NTFS& buf = vol.ntfs();
+  if (vol.isMapped()) {
+    LOG(LOG_INFO, "Memory-mapped the volume at offset %llu\n", vol.seekBase);
+  }
+  LOG(LOG_INFO, "mftOffset: %ju %ju\n", (uintmax_t)buf.mftOffset, (uintmax_t)(buf.mftOffset * buf.bytesPerCluster()));
 
-  MFTRecord rec = buf.getFirstMFTRecord(fd);
-  rec.applyFixup(buf.bytesPerSector);
-  printf("numberOfThisMFTRecord: %ju , sequenceNumber: %ju ; fileReferenceAddress of first MFT record: computed %ju stored %ju\n",(uintmax_t)rec.numberOfThisMFTRecord, (uintmax_t)rec.sequenceNumber, (uintmax_t)rec.computedFileReferenceAddress(), (uintmax_t)rec.fileReferenceToTheBase_FILE_record);
+  const MFTRecord* recPtr;
+  try {
+    recPtr = &vol.mftRecord(); // (Checked and fixed up)
+  }
+  catch (...) {
+    LOG(LOG_ERROR, "Can't read the first MFT entry.\n");
+    return 1;
+  }
+  const MFTRecord& rec = *recPtr;
+  LOG(LOG_INFO, "numberOfThisMFTRecord: %ju , sequenceNumber: %ju ; fileReferenceAddress of first MFT record: computed %ju stored %ju\n",(uintmax_t)rec.numberOfThisMFTRecord, (uintmax_t)rec.sequenceNumber, (uintmax_t)rec.computedFileReferenceAddress(), (uintmax_t)rec.fileReferenceToTheBase_FILE_record);
 
   auto attributes = rec.attributes();
   // for (auto& v : attributes) {
@@ -1155,104 +2553,306 @@ int main(int argc, char** argv) {
   //     }, v);
   // }
 
-  rec.hexDump();
+  if (LOG_ENABLED(LOG_DEBUG)) {
+    rec.hexDump();
+  }
 
 
   // Now that we have the first record, we know it is the $MFT itself (entry 0). So this is a file that references itself! We need to follow its $DATA attribute to get the full MFT contents. ( https://docs.microsoft.com/en-us/windows/win32/devnotes/master-file-table : "The $Mft file contains an unnamed $DATA attribute that is the sequence of MFT record segments, in order." )
   size_t limitToLoad = 1073741824; //max amount to load from a non-resident attribute
   bool moreNeeded; ssize_t more;
-  auto file_name_pair = findAttribute<FileName>(attributes, FILE_NAME, limitToLoad, &moreNeeded, &more, fd, &buf);
+  auto file_name_pair = findAttribute<FileName>(rec, FILE_NAME, limitToLoad, &moreNeeded, &more, vol);
   auto& file_name = file_name_pair.first;
   if (file_name.get() == nullptr) {
-    printf("Can't find $FILE_NAME in first MFT entry.\n");
+    LOG(LOG_ERROR, "Can't find $FILE_NAME in first MFT entry.\n");
     return 1;
   }
   auto arr = file_name->fileNameInUnicode();
   auto str = arr.to_string();
-  printf("Found $FILE_NAME in first MFT entry with file name: %s\n", str.c_str());
+  LOG(LOG_INFO, "Found $FILE_NAME in first MFT entry with file name: %s\n", str.c_str());
 
-  auto data_pair = findAttribute<Data>(attributes, DATA, limitToLoad, &moreNeeded, &more, fd, &buf);
+  size_t limitToPrint = 2048;
+  auto data_pair = [&](){ IOPhaseScope phase(IO_PHASE_MFT_LOAD); return findAttribute<Data>(rec, DATA, limitToPrint, &moreNeeded, &more, vol); }(); // (Its content is the MFT itself. Only the start of it is loaded, to print; the records we want are read one at a time with `Volume::getRecord`.)
   auto& data = data_pair.first;
   if (data.get() == nullptr) {
-    printf("Can't find $DATA in first MFT entry.\n");
+    LOG(LOG_ERROR, "Can't find $DATA in first MFT entry.\n");
+    return 1;
+  }
+  LOG(LOG_INFO, "Found $DATA in first MFT entry\n");
+  size_t amountToPrint = std::min(limitToPrint, limitToPrint+more);
+  if (LOG_ENABLED(LOG_DEBUG)) {
+    DumpHex(data.get(), amountToPrint);
+  }
+
+  // Get $VOLUME record, which is record 3, directly rather than by walking through $MFTMirr and $LogFile to it
+  const uint64_t volumeRecordNumber = 3;
+  RecordCheck check;
+  PooledMFTRecord volume = vol.getRecord(volumeRecordNumber, &check);
+  off_t volumeRecordOffset;
+  if (volume.get() == nullptr || !vol.recordOffset(volumeRecordNumber, &volumeRecordOffset)) {
+    LOG(LOG_ERROR, "Can't read the $Volume MFT record: %s\n", recordCheckName(check));
     return 1;
   }
-  printf("Found $DATA in first MFT entry\n");
-  size_t limitToPrint = 2048, actualContentSize = limitToLoad+more;
-  size_t amountToPrint = std::min(limitToPrint, actualContentSize);
-  DumpHex(data.get(), amountToPrint);
-
-  // Get $VOLUME record
-  assert(data_pair.second.has_value()); // FIXME: if $MFT's $DATA attribute is resident this will fail. So unlikely but still a fixme.
-  assert(data.isMalloced());
-  size_t amountAlreadyLoadedFromMDR = 0, seekedAmount;
-  auto recordAndBufAndMore_mftMirr = rec.next(*data_pair.second, actualContentSize, amountAlreadyLoadedFromMDR, data.release() /*this is also the buffer due to the above assertion*/, &seekedAmount, fd, &buf);
-  MFTRecord* mftMirr = recordAndBufAndMore_mftMirr.first;
-  data.emplace(unique_free<Data>((Data*)recordAndBufAndMore_mftMirr.second.first.release()));
-  more = recordAndBufAndMore_mftMirr.second.second;
-  actualContentSize += more;
-  amountAlreadyLoadedFromMDR += seekedAmount;
-  mftMirr->hexDump();
-  auto recordAndBufAndMore_logFile = mftMirr->next(*data_pair.second, actualContentSize, amountAlreadyLoadedFromMDR, data.release(), &seekedAmount, fd, &buf);
-  MFTRecord* logFile = recordAndBufAndMore_logFile.first;
-  data.emplace(unique_free<Data>((Data*)recordAndBufAndMore_logFile.second.first.release()));
-  more = recordAndBufAndMore_logFile.second.second;
-  actualContentSize += more;
-  amountAlreadyLoadedFromMDR += seekedAmount;
-  logFile->hexDump();
-  auto recordAndBufAndMore_volume = logFile->next(*data_pair.second, actualContentSize, amountAlreadyLoadedFromMDR, data.release(), &seekedAmount, fd, &buf);
-  MFTRecord* volume = recordAndBufAndMore_volume.first;
-  data.emplace(unique_free<Data>((Data*)recordAndBufAndMore_volume.second.first.release()));
-  more = recordAndBufAndMore_volume.second.second;
-  actualContentSize += more;
-  amountAlreadyLoadedFromMDR += seekedAmount;
-  volume->hexDump();
-  volume->applyFixup(buf.bytesPerSector);
+  if (LOG_ENABLED(LOG_DEBUG)) {
+    volume->hexDump();
+  }
 
   // TODO: make limitToLoad, etc. all use the existing buf properly here:
-  auto volume_information_pair = findAttribute<VolumeInformation>(volume->attributes(), VOLUME_INFORMATION, limitToLoad, &moreNeeded, &more, fd, &buf);
+  auto volume_information_pair = findAttribute<VolumeInformation>(*volume, VOLUME_INFORMATION, limitToLoad, &moreNeeded, &more, vol);
+  if (volume_information_pair.first.get() == nullptr) {
+    LOG(LOG_ERROR, "Can't find $VOLUME_INFORMATION in the $Volume MFT record.\n");
+    return 1;
+  }
   
   // Compute how many sectors from the start of the disk that the $VOLUME_INFORMATION attribute is:
   // FIXME: it is assumed the $VOLUME_INFORMATION is resident here; technically but unlikely it could be non-resident. If it were non-resident, the volume_information_pair.first.get() pointer would be in another block of memory allocated, making this subtraction wrong:
-  size_t bytesFromVolumeInformationToFirstEntry = (uint8_t*)volume_information_pair.first.get() - (uint8_t*)data.get(); // `data.get()` is the start of the MFT
-  size_t bytesFromVolumeStartToVolInfo = bytesFromVolumeInformationToFirstEntry + buf.mftOffsetInBytes();
+  size_t bytesFromVolumeRecordToVolInfo = (uint8_t*)volume_information_pair.first.get() - (uint8_t*)volume.get();
+  size_t bytesFromVolumeStartToVolInfo = volumeRecordOffset + bytesFromVolumeRecordToVolInfo; // (Assumes the record doesn't straddle two runs of the MFT, which would take clusters smaller than records)
   // Add the offset to the offsetof(VolumeInformation, flags)
   size_t bytesFromVolumeStartToVolFlags = bytesFromVolumeStartToVolInfo + offsetof(VolumeInformation, flags);
   size_t sectorsFromVolumeStartToVolFlags = bytesFromVolumeStartToVolFlags / buf.bytesPerSector;
   size_t bytesLeftOverWithinTheSectorOfVolFlags = bytesFromVolumeStartToVolFlags % buf.bytesPerSector; // Get the bytes remaining within the sector that the $VOLUME_INFORMATION is contained in.
   printf("sectorsFromVolumeStartToVolFlags: %ju, bytesPerSector: %ju, bytesLeftOverWithinTheSectorOfVolFlags: %ju\n", (uintmax_t)sectorsFromVolumeStartToVolFlags, (uintmax_t)buf.bytesPerSector, (uintmax_t)bytesLeftOverWithinTheSectorOfVolFlags);
 
-  // [wip implementation] Scan the MFT for hiberfil.sys //
-  //findFile(
-
-  // MFTRecord* prevEntry = recordAndBufAndMore_volume.first;
-  // size_t startingRecordNumber = ((uint8_t*)prevEntry - (uint8_t*)data.get()) / buf.bytesPerMFTFileRecord();
-  // printf("Scanning for hiberfil.sys starting at record number %zu\n", startingRecordNumber);
-  // for (size_t i = startingRecordNumber; i < 1000; i++) {
-  //   auto recordAndBufAndMore_mftEntry = prevEntry->next(*data_pair.second, actualContentSize, amountAlreadyLoadedFromMDR, data.release(), &seekedAmount, fd, &buf);
-  //   prevEntry = recordAndBufAndMore_mftEntry.first;
-  //   data.emplace(unique_free<Data>((Data*)recordAndBufAndMore_mftEntry.second.first.release()));
-  //   more = recordAndBufAndMore_mftEntry.second.second;
-  //   actualContentSize += more;
-  //   amountAlreadyLoadedFromMDR += seekedAmount;
-  //   //prevEntry->hexDump();
-  //   prevEntry->applyFixup(buf.bytesPerSector);
-
-  //   // Read from `prevEntry` now:
-  //   // TODO: make limitToLoad, etc. all use the existing buf properly here:
-  //   auto file_name_pair = findAttribute<FileName>(prevEntry->attributes(), FILE_NAME, limitToLoad, &moreNeeded, &more, fd, &buf);
-  //   auto& file_name = file_name_pair.first;
-  //   if (file_name.get() == nullptr) {
-  //     printf("Can't find $FILE_NAME in MFT entry %zu, skipping it.\n", i);
-  //     continue;
-  //   }
-  //   auto arr = file_name->fileNameInUnicode();
-  //   auto str = arr.to_string();
-  //   printf("Found $FILE_NAME in MFT entry %zu with file name: %s\n", i, str.c_str());
-  // }
+  // (To scan the whole MFT for a file such as hiberfil.sys, see the `find` command, which uses MFTScanner.)
 
-  // //
+  if (vol.blockCache != nullptr) {
+    BlockCache::Stats stats = vol.blockCache->stats();
+    LOG(LOG_INFO, "Cluster cache: %ju hits, %ju misses, %ju evictions\n", (uintmax_t)stats.hits, (uintmax_t)stats.misses, (uintmax_t)stats.evictions);
+  }
   
   BREAKPOINT;
-  _close(fd);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  // Options, which can go anywhere on the command line
+  std::vector<char*> args;
+  VolumeOptions options;
+  bool allRecords = false;
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--all-records") == 0) {
+      allRecords = true; // Don't skip the records that $MFT:$BITMAP says are unallocated
+      continue;
+    }
+    if (strcmp(argv[i], "--direct") == 0) {
+      options.directIO = true; // Bypass the page cache
+      continue;
+    }
+    if (strncmp(argv[i], "--prefetch=", strlen("--prefetch=")) == 0) {
+      _setPrefetchWindow(std::stoull(argv[i] + strlen("--prefetch=")));
+      continue;
+    }
+    if (strncmp(argv[i], "--coalesce-gap-kb=", strlen("--coalesce-gap-kb=")) == 0) {
+      _setCoalesceGapThreshold(std::stoull(argv[i] + strlen("--coalesce-gap-kb=")) * 1024);
+      continue;
+    }
+    if (strncmp(argv[i], "--queue-depth=", strlen("--queue-depth=")) == 0) {
+      unsigned long long queueDepth = std::stoull(argv[i] + strlen("--queue-depth="));
+      if (queueDepth == 0 || queueDepth > 4096) {
+	printf("The queue depth must be from 1 to 4096\n");
+	return 1;
+      }
+      _setReadQueueDepth(queueDepth);
+      continue;
+    }
+    if (strcmp(argv[i], "--io-stats") == 0) {
+      ioStats().enabled = true;
+      atexit([](){ ioStats().report(stdout); }); // (Runs however main returns)
+      continue;
+    }
+    if (strncmp(argv[i], "--log-level=", strlen("--log-level=")) == 0) {
+      if (!parseLogLevel(argv[i] + strlen("--log-level="), &logLevel())) {
+	printf("Unknown log level %s\n", argv[i] + strlen("--log-level="));
+	return 1;
+      }
+      continue;
+    }
+    if (strncmp(argv[i], "--cache-mb=", strlen("--cache-mb=")) == 0) {
+      options.blockCacheBudget = std::stoull(argv[i] + strlen("--cache-mb=")) * 1024 * 1024;
+      continue;
+    }
+    args.push_back(argv[i]);
+  }
+  argc = args.size();
+  argv = args.data();
+  
+  if (argc < 2) {
+    printf("Need at least one argument: the file to open as an NTFS partition, or an entire disk (or image of one) to scan all of the NTFS partitions in its MBR or GPT partition table. Alternatively, provide any file and an offset to seek within the file to the NTFS partition, optionally followed by a command: `rec <sector>` to read an MFT record at a sector, `find <name>` to scan the MFT for the records of files named <name>, `list` to list every file in the MFT, `record <number>` to read one MFT record by its number or by a file reference, or `frag [files]` to report how fragmented the files on the volume are (with a line per fragmented file if `files` is given). Options: --direct to bypass the page cache with O_DIRECT, --cache-mb=N to set the memory budget of the cluster cache (0 to disable it), --prefetch=N to set how many runs ahead to prefetch (0 to disable it), --coalesce-gap-kb=N to set how far apart runs can be and still be read together, --queue-depth=N to set how many reads can be in flight at once (default 32), --io-stats to print counters and latency histograms of the reads made at exit, --all-records to make the MFT scanning commands read every record instead of skipping those that $MFT:$BITMAP says are unallocated, --log-level=error|warn|info|debug|trace to choose how much to print as it goes (default info; debug and trace are only available in debug builds).");
+    return 1;
+  }
+  std::vector<Partition> volumes;
+  if (argc > 2) {
+    unsigned long long seekInFD = std::stoull(argv[2]); // Seek within the file given using this amount. All reads will be relative to it.
+    volumes.push_back({0, "none", seekInFD, 0});
+  }
+  else {
+    volumes = _findNTFSVolumes(argv[1]); // Find the volume(s) ourselves
+    if (volumes.empty()) {
+      printf("No NTFS volumes found in %s\n", argv[1]);
+      return 1;
+    }
+  }
+
+  if (argc > 3) {
+    Volume vol(argv[1], volumes[0].offset, options);
+    NTFS& buf = vol.ntfs();
+    const char* cmd = argv[3];
+    // Optional "command"
+    if (strcmp(cmd, "frag") == 0) {
+      // Fragmentation report of every file on the volume
+      try {
+	MFTScanner scanner(vol, MFT_SCAN_CHUNK_SIZE, !allRecords);
+	analyzeFragmentation(scanner).print(stdout, argc > 4 && strcmp(argv[4], "files") == 0);
+      }
+      catch (...) {
+	printf("Fragmentation analysis of the volume at offset %llu failed\n", vol.seekBase);
+	return 1;
+      }
+      return 0;
+    }
+    else if (strcmp(cmd, "find") == 0) {
+      // Print the records of the files with a given name, e.g. hiberfil.sys
+      if (argc < 5) {
+	printf("Need a file name to find. Exiting.\n");
+	return 1;
+      }
+      std::string name = argv[4];
+      MFTScanner::Stats stats;
+      try {
+	MFTScanner scanner(vol, MFT_SCAN_CHUNK_SIZE, !allRecords);
+	stats = scanner.scan([&](uint64_t recordNumber, MFTRecord* rec){
+	  if (_fileNameOf(rec) == name) {
+	    printf("Found %s in MFT record %ju\n", name.c_str(), (uintmax_t)recordNumber);
+	  }
+	});
+      }
+      catch (...) {
+	printf("Scanning the MFT of the volume at offset %llu failed\n", vol.seekBase);
+	return 1;
+      }
+      printf("Scanned %ju MFT records (%ju skipped, %ju torn, %ju corrupt, %ju unallocated, %ju bytes read)\n", (uintmax_t)stats.recordsScanned, (uintmax_t)stats.recordsSkipped, (uintmax_t)stats.recordsTorn, (uintmax_t)stats.recordsCorrupt, (uintmax_t)stats.recordsUnallocated, (uintmax_t)stats.bytesRead);
+      return 0;
+    }
+    else if (strcmp(cmd, "list") == 0) {
+      // List every file, parsing the records on all cores
+      MFTScanner::Stats stats;
+      std::vector<ParsedRecord> records;
+      try {
+	MFTScanner scanner(vol, MFT_SCAN_CHUNK_SIZE, !allRecords);
+	records = scanner.parallelScan<ParsedRecord>([](uint64_t recordNumber, MFTRecord* rec, std::vector<ParsedRecord>& out){
+	  out.push_back(_parseRecord(recordNumber, rec));
+	}, &stats);
+      }
+      catch (...) {
+	printf("Scanning the MFT of the volume at offset %llu failed\n", vol.seekBase);
+	return 1;
+      }
+      for (const ParsedRecord& r : records) {
+	if (r.baseRecordNumber != r.recordNumber) {
+	  continue; // Extension records don't have names of their own
+	}
+	printf("%10ju %c parent %10ju size %14ju %s\n", (uintmax_t)r.recordNumber, (r.flags & Directory) ? 'd' : '-', (uintmax_t)r.parentRecordNumber, (uintmax_t)r.size, r.name.c_str());
+      }
+      printf("Scanned %ju MFT records (%ju skipped, %ju torn, %ju corrupt, %ju unallocated, %ju bytes read)\n", (uintmax_t)stats.recordsScanned, (uintmax_t)stats.recordsSkipped, (uintmax_t)stats.recordsTorn, (uintmax_t)stats.recordsCorrupt, (uintmax_t)stats.recordsUnallocated, (uintmax_t)stats.bytesRead);
+      return 0;
+    }
+    else if (strcmp(cmd, "record") == 0) {
+      // Read one MFT record by its number (or a file reference, whose sequence number in the top 16 bits is checked against the record's)
+      if (argc < 5) {
+	printf("Need the record number or file reference. Exiting.\n");
+	return 1;
+      }
+      uint64_t reference = std::stoull(argv[4], nullptr, 0);
+      uint64_t recordNumber = reference & 0xffffffffffff;
+      uint16_t sequenceNumber = reference >> 48;
+      RecordCheck check;
+      PooledMFTRecord rec;
+      try {
+	rec = vol.getRecord(recordNumber, &check);
+      }
+      catch (...) {
+	printf("Can't read MFT record %ju: can't find the MFT's runs\n", (uintmax_t)recordNumber);
+	return 1;
+      }
+      if (rec.get() == nullptr) {
+	printf("Can't read MFT record %ju: %s\n", (uintmax_t)recordNumber, recordCheckName(check));
+	return 1;
+      }
+      if (sequenceNumber != 0 && sequenceNumber != rec->sequenceNumber) {
+	printf("Stale file reference: MFT record %ju has sequence number %ju, not %ju\n", (uintmax_t)recordNumber, (uintmax_t)rec->sequenceNumber, (uintmax_t)sequenceNumber);
+	return 1;
+      }
+      ParsedRecord r = _parseRecord(recordNumber, rec.get());
+      printf("%10ju %c parent %10ju size %14ju %s\n", (uintmax_t)r.recordNumber, (r.flags & Directory) ? 'd' : '-', (uintmax_t)r.parentRecordNumber, (uintmax_t)r.size, r.name.c_str());
+      if (LOG_ENABLED(LOG_DEBUG)) {
+	rec->hexDump();
+      }
+      return 0;
+    }
+    else if (strcmp(cmd, "rec") == 0) {
+      // Read record at addr
+      
+      long long seekToAddr;
+      // printf("Enter a number of sectors to seek to in order to grab an MFT record there: ");
+      // int ret = scanf(" %d", &seekToAddr);
+      // if (ret == EOF) {
+      // 	perror("scanf failed");
+      // }
+      // int expected = 1;
+      // if (ret < expected) {
+      // 	printf("Not enough grabbed by scanf (got %d out of %d). Exiting.\n", ret, expected);
+      // 	return 1;
+      // }
+
+      if (argc < 4) {
+	printf("Need another argument. Exiting.\n");
+	return 1;
+      }
+      seekToAddr = std::stoll(argv[4]);
+      // Seek to it and grab an MFT record
+      off_t dest = seekToAddr * buf.bytesPerSector;
+      LOG(LOG_DEBUG, "buf.bytesPerSector: %ju, dest in sectors: %jd dest in bytes: %jd\n", (uintmax_t)buf.bytesPerSector, (intmax_t)seekToAddr, (intmax_t)dest);
+      PooledMFTRecord buf2 = vol.acquireRecord();
+      vol.pread(buf2.get(), buf2.size(), dest);
+  
+      BREAKPOINT;
+      return 0;
+    }
+    else {
+      printf("Unknown command\n");
+      return 1;
+    }
+  }
+
+  if (volumes.size() == 1) {
+    Volume vol(argv[1], volumes[0].offset, options);
+    return scanVolume(vol);
+  }
+
+  // Scan all the volumes at once, sharing the read engine, so that this takes about as long as the largest one rather than all of them added up
+  std::vector<int> results(volumes.size(), 1);
+  {
+    TaskGroup group(_threadPool());
+    for (size_t i = 0; i < volumes.size(); i++) {
+      group.run([&, i](){
+	const Partition& p = volumes[i];
+	printf("Scanning %s partition %u at offset %llu (%llu bytes)\n", p.scheme, p.number, p.offset, p.length);
+	try {
+	  Volume vol(argv[1], p.offset, options);
+	  results[i] = scanVolume(vol);
+	}
+	catch (...) {
+	  printf("Scanning %s partition %u at offset %llu failed\n", p.scheme, p.number, p.offset);
+	}
+      });
+    }
+    group.wait();
+  }
+  int ret = 0;
+  for (size_t i = 0; i < volumes.size(); i++) {
+    printf("%s partition %u at offset %llu: %s\n", volumes[i].scheme, volumes[i].number, volumes[i].offset, results[i] == 0 ? "done" : "failed");
+    ret = std::max(ret, results[i]);
+  }
+  return ret;
 }
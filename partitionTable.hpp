@@ -0,0 +1,165 @@
+// Finding the partitions of a whole disk (or an image of one) from its MBR or GPT partition table, so that the NTFS volumes on it can be opened without working out their byte offsets by hand.
+// MBR: https://en.wikipedia.org/wiki/Master_boot_record , extended partitions: https://en.wikipedia.org/wiki/Extended_boot_record , GPT: https://en.wikipedia.org/wiki/GUID_Partition_Table
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <vector>
+#include <memory>
+#include "readEngine.hpp"
+
+struct Partition {
+  unsigned number; // 1-based, numbered the way Linux does (so logical partitions of an MBR disk start at 5)
+  const char* scheme; // "MBR" or "GPT"
+  unsigned long long offset; // In bytes from the start of the disk
+  unsigned long long length; // In bytes
+};
+
+#pragma pack(1)
+struct MBRPartitionEntry {
+  uint8_t status; // 0x80 if bootable
+  uint8_t firstCHS[3];
+  uint8_t type;
+  uint8_t lastCHS[3];
+  uint32_t firstLBA;
+  uint32_t numberOfSectors;
+};
+static_assert(sizeof(MBRPartitionEntry) == 16);
+
+struct MBR {
+  uint8_t bootstrapCode[446];
+  MBRPartitionEntry partitions[4];
+  uint16_t signature; // 0xAA55
+
+  static const uint8_t TYPE_EMPTY = 0x00;
+  static const uint8_t TYPE_GPT_PROTECTIVE = 0xEE;
+  static bool isExtendedType(uint8_t type) {
+    return type == 0x05 || type == 0x0F || type == 0x85;
+  }
+};
+static_assert(sizeof(MBR) == 512);
+
+struct GPTHeader {
+  char signature[8]; // "EFI PART"
+  uint32_t revision;
+  uint32_t headerSize;
+  uint32_t headerCRC32;
+  uint32_t reserved;
+  uint64_t currentLBA;
+  uint64_t backupLBA;
+  uint64_t firstUsableLBA;
+  uint64_t lastUsableLBA;
+  uint8_t diskGUID[16];
+  uint64_t partitionEntriesLBA;
+  uint32_t numberOfPartitionEntries;
+  uint32_t sizeOfPartitionEntry; // 128 in practice, but must be honoured
+  uint32_t partitionEntriesCRC32;
+};
+static_assert(sizeof(GPTHeader) == 92);
+
+struct GPTPartitionEntry {
+  uint8_t typeGUID[16]; // All zeroes if the entry is unused
+  uint8_t uniqueGUID[16];
+  uint64_t firstLBA;
+  uint64_t lastLBA; // Inclusive
+  uint64_t attributes;
+  uint16_t name[36]; // UTF-16LE
+};
+static_assert(sizeof(GPTPartitionEntry) == 128);
+#pragma pack()
+
+// Reads the GPT whose header is at LBA 1 for a sector size of `sectorSize`. Returns false if there isn't one there.
+inline bool readGPT(int fd, size_t sectorSize, std::vector<Partition>& out) {
+  std::unique_ptr<uint8_t[]> sector(new uint8_t[sectorSize]);
+  preadFully(fd, sector.get(), sectorSize, sectorSize);
+  GPTHeader header;
+  memcpy(&header, sector.get(), sizeof(header));
+  if (memcmp(header.signature, "EFI PART", sizeof(header.signature)) != 0) {
+    return false;
+  }
+  // Both come from the disk, so bound them before allocating: entries are at least 128 bytes and a multiple of 8 ("128 x 2^n" in the UEFI spec), and the array is 16 KiB in practice
+  const size_t maxEntriesSize = 1024 * 1024;
+  size_t entriesSize = (size_t)header.sizeOfPartitionEntry * header.numberOfPartitionEntries;
+  if (header.sizeOfPartitionEntry < sizeof(GPTPartitionEntry) || header.sizeOfPartitionEntry % 8 != 0 || header.numberOfPartitionEntries > 65536 || entriesSize > maxEntriesSize) {
+    fprintf(stderr, "readGPT: unsupported partition entry size %u or count %u\n", header.sizeOfPartitionEntry, header.numberOfPartitionEntries);
+    return false;
+  }
+
+  std::unique_ptr<uint8_t[]> entries(new uint8_t[entriesSize]);
+  preadFully(fd, entries.get(), entriesSize, header.partitionEntriesLBA * sectorSize);
+  static const uint8_t unusedGUID[16] = {0};
+  for (uint32_t i = 0; i < header.numberOfPartitionEntries; i++) {
+    GPTPartitionEntry entry;
+    memcpy(&entry, entries.get() + (size_t)i * header.sizeOfPartitionEntry, sizeof(entry));
+    if (memcmp(entry.typeGUID, unusedGUID, sizeof(unusedGUID)) == 0 || entry.lastLBA < entry.firstLBA) {
+      continue;
+    }
+    out.push_back({i + 1, "GPT", entry.firstLBA * sectorSize, (entry.lastLBA - entry.firstLBA + 1) * sectorSize});
+  }
+  return true;
+}
+
+// Follows the chain of extended boot records of the extended partition starting at LBA `extendedStart`, adding its logical partitions.
+inline void readExtendedPartitions(int fd, size_t sectorSize, uint64_t extendedStart, std::vector<Partition>& out) {
+  unsigned number = 5;
+  uint64_t ebrLBA = extendedStart;
+  for (unsigned hops = 0; hops < 128; hops++) { // (Bounded in case the chain loops)
+    MBR ebr;
+    preadFully(fd, &ebr, sizeof(ebr), ebrLBA * sectorSize);
+    if (ebr.signature != 0xAA55) {
+      fprintf(stderr, "readExtendedPartitions: bad signature in the extended boot record at LBA %ju\n", (uintmax_t)ebrLBA);
+      return;
+    }
+    const MBRPartitionEntry& logical = ebr.partitions[0]; // Relative to this EBR
+    if (logical.type != MBR::TYPE_EMPTY && logical.numberOfSectors != 0) {
+      out.push_back({number++, "MBR", (ebrLBA + logical.firstLBA) * sectorSize, (unsigned long long)logical.numberOfSectors * sectorSize});
+    }
+    const MBRPartitionEntry& next = ebr.partitions[1]; // Relative to the start of the extended partition
+    if (!MBR::isExtendedType(next.type) || next.firstLBA == 0) {
+      return;
+    }
+    ebrLBA = extendedStart + next.firstLBA;
+  }
+}
+
+// Returns the partitions listed in the partition table of the disk in `fd`, which is GPT if the MBR is a protective one. Returns an empty vector if there is no partition table. (Note that an NTFS boot sector also ends in the MBR signature, so check for that first.)
+inline std::vector<Partition> readPartitionTable(int fd) {
+  std::vector<Partition> ret;
+  size_t sectorSize = 512;
+  int blockSize;
+  if (ioctl(fd, BLKSSZGET, &blockSize) == 0) {
+    sectorSize = blockSize; // A device, so we know its logical sector size
+  }
+
+  MBR mbr;
+  preadFully(fd, &mbr, sizeof(mbr), 0);
+  if (mbr.signature != 0xAA55) {
+    return ret;
+  }
+  for (const MBRPartitionEntry& p : mbr.partitions) {
+    if (p.type == MBR::TYPE_GPT_PROTECTIVE) {
+      // Images don't tell us their sector size, so try the other common one too
+      if (readGPT(fd, sectorSize, ret) || (sectorSize == 512 && readGPT(fd, 4096, ret))) {
+	return ret;
+      }
+      fprintf(stderr, "readPartitionTable: protective MBR but no GPT header found; using the MBR\n");
+      break;
+    }
+  }
+  for (unsigned i = 0; i < 4; i++) {
+    const MBRPartitionEntry& p = mbr.partitions[i];
+    if (p.type == MBR::TYPE_EMPTY || p.type == MBR::TYPE_GPT_PROTECTIVE || p.numberOfSectors == 0) {
+      continue;
+    }
+    if (MBR::isExtendedType(p.type)) {
+      readExtendedPartitions(fd, sectorSize, p.firstLBA, ret);
+      continue;
+    }
+    ret.push_back({i + 1, "MBR", (unsigned long long)p.firstLBA * sectorSize, (unsigned long long)p.numberOfSectors * sectorSize});
+  }
+  return ret;
+}
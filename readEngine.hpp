@@ -0,0 +1,471 @@
+// Asynchronous read engines: submit many reads at once and wait for all of them, letting them complete in any order. `makeReadEngine` uses io_uring if the kernel supports it and falls back to a pool of threads doing pread() otherwise.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
+#include "threadPool.hpp"
+#include "ioStats.hpp"
+
+// A single read to make. `offset` is from the start of the file (not the volume).
+struct ReadRequest {
+  void* buf;
+  size_t length;
+  off_t offset;
+  const struct iovec* iov = nullptr; // If non-null, the read is scattered into these `iovcnt` buffers in order instead of into `buf` (and `length` is their total length).
+  int iovcnt = 0;
+};
+
+class ReadEngine {
+public:
+  virtual ~ReadEngine() {}
+
+  // Reads all of `requests` (each one fully, retrying short reads), returning once they are all done. Throws errno on failure, after any reads still in flight have finished.
+  virtual void readAll(int fd, const std::vector<ReadRequest>& requests) = 0;
+
+  virtual const char* name() const = 0;
+};
+
+// pread()s the range, retrying on short reads, until it is done or the end of the file is reached. Returns how many bytes were read. Throws errno on failure.
+inline size_t preadUntilEOF(int fd, void* buf, size_t count, off_t offset) {
+  size_t done = 0;
+  while (done < count) {
+    uint64_t startTime = ioStats().start();
+    ssize_t ret = pread(fd, (uint8_t*)buf + done, count - done, offset + done);
+    ioStats().recordRead(currentIOPhase(), startTime, fd, offset + done, ret > 0 ? ret : 0);
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+      perror("pread failed");
+      throw errno;
+    }
+    else if (ret == 0) {
+      break;
+    }
+    done += ret;
+  }
+  return done;
+}
+
+// pread()s the whole range, retrying on short reads. Throws errno on failure, or EIO if the file ends first.
+inline void preadFully(int fd, void* buf, size_t count, off_t offset) {
+  size_t done = preadUntilEOF(fd, buf, count, offset);
+  if (done < count) {
+    fprintf(stderr, "pread got too few bytes: expected %zu but got %zu at file offset %jd\n", count, done, (intmax_t)offset);
+    throw EIO;
+  }
+}
+
+// preadv()s the whole range, retrying on short reads. Throws errno on failure.
+inline void preadvFully(int fd, const struct iovec* iov_, int iovcnt, off_t offset) {
+  std::vector<struct iovec> iov(iov_, iov_ + iovcnt); // (Copied since it is advanced after short reads)
+  size_t first = 0;
+  size_t done = 0;
+  while (first < iov.size()) {
+    uint64_t startTime = ioStats().start();
+    ssize_t ret = preadv(fd, &iov[first], std::min((int)(iov.size() - first), IOV_MAX), offset + done);
+    ioStats().recordRead(currentIOPhase(), startTime, fd, offset + done, ret > 0 ? ret : 0);
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+      perror("preadv failed");
+      throw errno;
+    }
+    else if (ret == 0) {
+      fprintf(stderr, "preadv got too few bytes: got %zu at file offset %jd\n", done, (intmax_t)offset);
+      throw EIO;
+    }
+    done += ret;
+    size_t left = ret;
+    while (first < iov.size() && left >= iov[first].iov_len) {
+      left -= iov[first].iov_len;
+      first++;
+    }
+    if (first < iov.size()) {
+      iov[first].iov_base = (uint8_t*)iov[first].iov_base + left;
+      iov[first].iov_len -= left;
+    }
+  }
+}
+
+inline void readFully(int fd, const ReadRequest& r) {
+  if (r.iov != nullptr) {
+    preadvFully(fd, r.iov, r.iovcnt, r.offset);
+  }
+  else {
+    preadFully(fd, r.buf, r.length, r.offset);
+  }
+}
+
+// Requests merged by `coalesceRequests`, along with the memory they point to.
+struct CoalescedRequests {
+  std::vector<ReadRequest> requests;
+  std::vector<std::vector<struct iovec>> iovs; // What the merged `requests` point to
+  std::unique_ptr<uint8_t[]> discard; // Where the bytes in gaps between merged requests are read to
+};
+
+// Merges runs of consecutive requests whose file ranges follow each other, either exactly or after a gap of at most `gapThreshold` bytes, into single vectored requests. This trades reading (and throwing away) the gaps for fewer I/Os.
+inline void coalesceRequests(const std::vector<ReadRequest>& in, size_t gapThreshold, CoalescedRequests& out) {
+  out.requests.clear();
+  out.iovs.clear();
+  auto appendTo = [](std::vector<struct iovec>& iov, const ReadRequest& r) {
+    if (r.iov != nullptr) {
+      iov.insert(iov.end(), r.iov, r.iov + r.iovcnt);
+    }
+    else {
+      iov.push_back({r.buf, r.length});
+    }
+  };
+
+  size_t groupStart = 0;
+  while (groupStart < in.size()) {
+    // Find the end of this group
+    size_t groupEnd = groupStart + 1;
+    off_t end = in[groupStart].offset + in[groupStart].length;
+    size_t iovcnt = in[groupStart].iov != nullptr ? in[groupStart].iovcnt : 1;
+    while (groupEnd < in.size()) {
+      const ReadRequest& r = in[groupEnd];
+      size_t rIovcnt = r.iov != nullptr ? r.iovcnt : 1;
+      if (r.offset < end || (size_t)(r.offset - end) > gapThreshold || iovcnt + rIovcnt + 1 > IOV_MAX) {
+	break;
+      }
+      iovcnt += rIovcnt + (r.offset > end ? 1 : 0);
+      end = r.offset + r.length;
+      groupEnd++;
+    }
+
+    if (groupEnd == groupStart + 1) {
+      out.requests.push_back(in[groupStart]);
+    }
+    else {
+      std::vector<struct iovec> iov;
+      iov.reserve(iovcnt);
+      off_t pos = in[groupStart].offset;
+      for (size_t i = groupStart; i < groupEnd; i++) {
+	const ReadRequest& r = in[i];
+	if (r.offset > pos) {
+	  if (out.discard == nullptr) {
+	    out.discard.reset(new uint8_t[gapThreshold]);
+	  }
+	  iov.push_back({out.discard.get(), (size_t)(r.offset - pos)});
+	}
+	appendTo(iov, r);
+	pos = r.offset + r.length;
+      }
+      out.requests.push_back({nullptr, (size_t)(pos - in[groupStart].offset), in[groupStart].offset});
+      out.iovs.push_back(std::move(iov));
+    }
+    groupStart = groupEnd;
+  }
+
+  // Point the merged requests at their iovecs now that `out.iovs` won't move them any more
+  size_t next = 0;
+  for (ReadRequest& r : out.requests) {
+    if (r.buf == nullptr && r.iov == nullptr) {
+      r.iov = out.iovs[next].data();
+      r.iovcnt = out.iovs[next].size();
+      next++;
+    }
+  }
+}
+
+// Runs the requests one after another on the calling thread.
+class SyncReadEngine: public ReadEngine {
+public:
+  void readAll(int fd, const std::vector<ReadRequest>& requests) override {
+    for (const ReadRequest& r : requests) {
+      readFully(fd, r);
+    }
+  }
+
+  const char* name() const override { return "synchronous"; }
+};
+
+// Runs each request as a pread() on a pool of `queueDepth` threads.
+class ThreadPoolReadEngine: public ReadEngine {
+public:
+  explicit ThreadPoolReadEngine(unsigned queueDepth): pool(queueDepth) {}
+
+  void readAll(int fd, const std::vector<ReadRequest>& requests) override {
+    TaskGroup group(pool);
+    IOPhase phase = currentIOPhase();
+    for (const ReadRequest& r : requests) {
+      group.run([fd, r, phase](){ IOPhaseScope scope(phase); readFully(fd, r); });
+    }
+    group.wait();
+  }
+
+  const char* name() const override { return "thread pool"; }
+
+protected:
+  ThreadPool pool;
+};
+
+// Submits reads through an io_uring with up to `queueDepth` of them in flight at once. This uses the raw syscalls so that liburing isn't needed.
+class IoUringReadEngine: public ReadEngine {
+public:
+  // Returns nullptr if io_uring isn't available (old kernel, disabled by seccomp or sysctl, etc.)
+  static std::unique_ptr<IoUringReadEngine> create(unsigned queueDepth) {
+    std::unique_ptr<IoUringReadEngine> ret(new IoUringReadEngine());
+    if (!ret->setup(queueDepth)) {
+      return nullptr;
+    }
+    return ret;
+  }
+
+  IoUringReadEngine(const IoUringReadEngine& other) = delete;
+
+  ~IoUringReadEngine() {
+    if (sqes != nullptr) munmap(sqes, sqesSize);
+    if (cqRing != nullptr && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing != nullptr) munmap(sqRing, sqRingSize);
+    if (ringFd != -1) close(ringFd);
+  }
+
+  // Many threads (e.g. one per volume being scanned) can call this at once: they share the ring, each submitting its own reads, and whichever of them is waiting reaps every completion and hands it to the call it belongs to.
+  void readAll(int fd, const std::vector<ReadRequest>& requests) override {
+    Batch batch;
+    batch.phase = currentIOPhase(); // (Completions may be reaped by another thread)
+    batch.fd = fd;
+    batch.slots.resize(requests.size());
+    batch.toSubmit.reserve(requests.size());
+    for (size_t i = requests.size(); i > 0; i--) {
+      const ReadRequest& r = requests[i-1];
+      Slot& slot = batch.slots[i-1];
+      slot.batch = &batch;
+      if (r.iov != nullptr) {
+	slot.remaining.assign(r.iov, r.iov + r.iovcnt);
+      }
+      else {
+	slot.remaining.push_back({r.buf, r.length});
+      }
+      slot.offset = r.offset;
+      if (r.length > 0) {
+	batch.toSubmit.push_back(i-1); // (Pushed in reverse so that they are popped off the back in order)
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (batch.inFlight > 0 || (batch.error == 0 && !batch.toSubmit.empty())) {
+      // Fill the submission queue with as many of ours as there is room for
+      unsigned submitted = 0;
+      unsigned tail = *sqTail;
+      while (batch.error == 0 && !batch.toSubmit.empty() && inFlight < entries) {
+	size_t i = batch.toSubmit.back();
+	batch.toSubmit.pop_back();
+	Slot& slot = batch.slots[i];
+	unsigned index = tail & *sqMask;
+	struct io_uring_sqe* sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->off = slot.offset;
+	sqe->addr = (uint64_t)(uintptr_t)&slot.remaining[slot.firstIov];
+	sqe->len = slot.remaining.size() - slot.firstIov;
+	sqe->user_data = (uint64_t)(uintptr_t)&slot;
+	slot.startTime = ioStats().start();
+	sqArray[index] = index;
+	tail++;
+	submitted++;
+	inFlight++;
+	batch.inFlight++;
+      }
+      __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+      unsubmitted += submitted;
+      if (unsubmitted > 0) {
+	enter(unsubmitted, 0);
+      }
+
+      if (reaping) {
+	// Another call is waiting for completions and will hand us ours
+	reaped.wait(lock);
+	continue;
+      }
+
+      // Wait for at least one completion without holding the lock, so that other calls can submit in the meantime
+      reaping = true;
+      lock.unlock();
+      try {
+	enter(0, 1);
+      }
+      catch (...) {
+	lock.lock();
+	reaping = false;
+	reaped.notify_all();
+	throw;
+      }
+      lock.lock();
+      reapCompletions();
+      reaping = false;
+      reaped.notify_all();
+    }
+
+    if (batch.error != 0) {
+      throw batch.error;
+    }
+  }
+
+  const char* name() const override { return "io_uring"; }
+
+protected:
+  // One read of a `readAll` call
+  struct Batch;
+  struct Slot {
+    Batch* batch;
+    std::vector<struct iovec> remaining; // What is left of the request, which changes if the kernel returns a short read
+    size_t firstIov = 0; // Index of the first iovec in `remaining` that isn't full yet
+    off_t offset;
+    uint64_t startTime; // For `ioStats()`
+  };
+  // The reads of one `readAll` call
+  struct Batch {
+    std::vector<Slot> slots;
+    std::vector<size_t> toSubmit; // Indices into `slots`
+    size_t inFlight = 0;
+    int error = 0;
+    IOPhase phase;
+    int fd; // The file being read, for the seek statistics
+  };
+
+  int ringFd = -1;
+  unsigned entries = 0;
+  std::mutex mutex; // Guards the ring and everything below
+  std::condition_variable reaped; // Signalled whenever completions have been handed out
+  bool reaping = false; // Whether a call is waiting for completions
+  unsigned inFlight = 0; // Reads of all calls, including ones put in the submission queue but not yet consumed by the kernel
+  unsigned unsubmitted = 0; // Put in the submission queue but not yet consumed by the kernel
+
+  // Submits `toSubmit` entries from the submission queue and waits for `minComplete` completions.
+  void enter(unsigned toSubmit, unsigned minComplete) {
+    int ret = syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+    if (ret == -1) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+	perror("io_uring_enter failed");
+	throw errno;
+      }
+    }
+    else if (toSubmit > 0) {
+      unsubmitted -= ret;
+    }
+  }
+
+  // Hands every completion in the completion queue to the batch it belongs to. Call with `mutex` held.
+  void reapCompletions() {
+    unsigned head = *cqHead;
+    while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+      Slot& slot = *(Slot*)(uintptr_t)cqe->user_data;
+      Batch& batch = *slot.batch;
+      int res = cqe->res;
+      ioStats().recordRead(batch.phase, slot.startTime, batch.fd, slot.offset, res > 0 ? res : 0);
+      head++;
+      inFlight--;
+      batch.inFlight--;
+      if (res == -EINTR || res == -EAGAIN) {
+	batch.toSubmit.push_back(&slot - batch.slots.data());
+      }
+      else if (res < 0) {
+	errno = -res;
+	perror("io_uring read failed");
+	batch.error = -res;
+      }
+      else if (res == 0) {
+	fprintf(stderr, "io_uring read got too few bytes at file offset %jd\n", (intmax_t)slot.offset);
+	batch.error = EIO;
+      }
+      else {
+	// Skip past the buffers that were filled
+	std::vector<struct iovec>& iov = slot.remaining;
+	size_t left = res;
+	while (slot.firstIov < iov.size() && left >= iov[slot.firstIov].iov_len) {
+	  left -= iov[slot.firstIov].iov_len;
+	  slot.firstIov++;
+	}
+	if (slot.firstIov < iov.size()) {
+	  // Short read; read the rest
+	  iov[slot.firstIov].iov_base = (uint8_t*)iov[slot.firstIov].iov_base + left;
+	  iov[slot.firstIov].iov_len -= left;
+	  slot.offset += res;
+	  batch.toSubmit.push_back(&slot - batch.slots.data());
+	}
+      }
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  void* sqRing = nullptr; size_t sqRingSize = 0;
+  void* cqRing = nullptr; size_t cqRingSize = 0;
+  struct io_uring_sqe* sqes = nullptr; size_t sqesSize = 0;
+  unsigned *sqTail, *sqMask, *sqArray;
+  unsigned *cqHead, *cqTail, *cqMask;
+  struct io_uring_cqe* cqes;
+
+  IoUringReadEngine() {}
+
+  bool setup(unsigned queueDepth) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ringFd = syscall(__NR_io_uring_setup, queueDepth, &p);
+    if (ringFd == -1) {
+      return false;
+    }
+    entries = p.sq_entries;
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool singleMmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+      sqRing = nullptr;
+      return false;
+    }
+    if (singleMmap) {
+      cqRing = sqRing;
+    }
+    else {
+      cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+      if (cqRing == MAP_FAILED) {
+	cqRing = nullptr;
+	return false;
+      }
+    }
+    sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+      sqes = nullptr;
+      return false;
+    }
+
+    sqTail = (unsigned*)((uint8_t*)sqRing + p.sq_off.tail);
+    sqMask = (unsigned*)((uint8_t*)sqRing + p.sq_off.ring_mask);
+    sqArray = (unsigned*)((uint8_t*)sqRing + p.sq_off.array);
+    cqHead = (unsigned*)((uint8_t*)cqRing + p.cq_off.head);
+    cqTail = (unsigned*)((uint8_t*)cqRing + p.cq_off.tail);
+    cqMask = (unsigned*)((uint8_t*)cqRing + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)((uint8_t*)cqRing + p.cq_off.cqes);
+    return true;
+  }
+};
+
+// Makes an io_uring engine if possible, otherwise a thread pool one.
+inline std::unique_ptr<ReadEngine> makeReadEngine(unsigned queueDepth) {
+  std::unique_ptr<ReadEngine> ret = IoUringReadEngine::create(queueDepth);
+  if (ret == nullptr) {
+    ret.reset(new ThreadPoolReadEngine(queueDepth));
+  }
+  return ret;
+}
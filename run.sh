@@ -10,6 +10,7 @@
 #./a.out /dev/loop4
 
 #./a.out /dev/mapper/qemu_OS2
+#./a.out /dev/mapper/qemu_readonly # (Finds and scans all of the NTFS partitions on the disk)
 
 #./a.out /dev/sde8
 #./a.out /dev/sde4
@@ -19,7 +19,6 @@ mkShell {
   buildInputs = [
     my-python-packages
     gcc
-    gmp
     valgrind
     gdb
   ];
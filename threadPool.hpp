@@ -0,0 +1,167 @@
+// A fixed-size pool of worker threads plus groups of tasks that can be waited on.
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <atomic>
+
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t numThreads = std::max(1u, std::thread::hardware_concurrency())) {
+    for (size_t i = 0; i < numThreads; i++) {
+      threads.emplace_back([this](){ workerLoop(); });
+    }
+  }
+
+  ThreadPool(const ThreadPool& other) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  size_t size() const { return threads.size(); }
+
+  // Queues `task` to run on one of the worker threads.
+  void post(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    cv.notify_one();
+  }
+
+  // Runs one queued task on the calling thread if there is one. Returns false if the queue was empty. (This lets a thread that is waiting on tasks help out instead of blocking, so waiting from within a task can't deadlock the pool.)
+  bool runOne() {
+    std::function<void()> task;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (tasks.empty()) {
+	return false;
+      }
+      task = std::move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+    return true;
+  }
+
+protected:
+  std::vector<std::thread> threads;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping = false;
+
+  void workerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+	std::unique_lock<std::mutex> lock(mutex);
+	cv.wait(lock, [this](){ return stopping || !tasks.empty(); });
+	if (tasks.empty()) {
+	  return; // Stopping
+	}
+	task = std::move(tasks.front());
+	tasks.pop_front();
+      }
+      task();
+    }
+  }
+};
+
+// A set of tasks run on a ThreadPool that can be waited on together. The first exception thrown by any of the tasks is rethrown by `wait()`.
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool& pool_): pool(pool_) {}
+
+  TaskGroup(const TaskGroup& other) = delete;
+
+  ~TaskGroup() {
+    try { wait(); } catch (...) {}
+  }
+
+  void run(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending++;
+    }
+    pool.post([this, task = std::move(task)](){
+      try {
+	task();
+      }
+      catch (...) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!error) {
+	  error = std::current_exception();
+	}
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending == 0) {
+	cv.notify_all();
+      }
+    });
+  }
+
+  // Waits for all tasks run so far, helping to run queued tasks in the meantime.
+  void wait() {
+    while (true) {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (pending == 0) {
+	  break;
+	}
+      }
+      if (!pool.runOne()) {
+	std::unique_lock<std::mutex> lock(mutex);
+	cv.wait(lock, [this](){ return pending == 0; });
+	break;
+      }
+    }
+
+    std::exception_ptr e;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::swap(e, error);
+    }
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  }
+
+protected:
+  ThreadPool& pool;
+  size_t pending = 0;
+  std::exception_ptr error;
+  std::mutex mutex;
+  std::condition_variable cv;
+};
+
+// Calls `fn(index, worker)` for every index in [0, count) on up to `pool.size()` workers (the calling thread helps too, see `TaskGroup::wait`). Each worker claims the next unclaimed index from one shared atomic counter when it finishes one, so workers that get cheap indices take on more of them instead of idling while others finish. (There are no per-worker queues to steal from: for a flat range of indices the counter balances the load just as well, and the tasks themselves go through the pool's single queue.) `worker` is in [0, number of workers) and is only used by one thread at a time, so it can index per-worker state such as buffers. Rethrows the first exception thrown by `fn`.
+template <typename Fn>
+void parallelFor(ThreadPool& pool, size_t count, Fn&& fn) {
+  std::atomic<size_t> next{0};
+  size_t workers = std::min(pool.size(), count);
+  TaskGroup group(pool);
+  for (size_t w = 0; w < workers; w++) {
+    group.run([&, w](){
+      for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+	fn(i, w);
+      }
+    });
+  }
+  group.wait();
+}